@@ -0,0 +1,100 @@
+#ifndef __Block_Match_h
+#define __Block_Match_h
+
+//struct to hold the motion vectors and MSE for each macroblock
+struct block_data
+{
+	int motion_vector_x;
+	int motion_vector_y;
+	float MSE;
+};
+
+//struct to hold the 9 MSE - Searchblock pairs
+struct MSE_per_Macroblock
+{
+	//0 -> top left block
+	//1 -> top centre block
+	//2 -> top right block
+	//3 -> middle left block
+	//4 -> middle centre block
+	//5 -> middle right left block
+	//6 -> bottom left block
+	//7 -> bottom centre block
+	//8 -> bottom right block
+	float block[9];
+};
+
+//MSE given to search blocks which are out of the frame
+const float OUT_OF_BOUNDS_MSE = 50000000;
+
+//functions used by both the kernels and the CPU backend
+#ifdef __CUDACC__
+#define BLOCK_MATCH_HOST_DEVICE __host__ __device__
+#else
+#define BLOCK_MATCH_HOST_DEVICE
+#endif
+
+//Function used to update a macroblock with the search block having the lowest MSE in a step
+//Inputs: macroblock data to be updated, the MSE of its 9 search blocks, search distances of the step
+//Output: None
+BLOCK_MATCH_HOST_DEVICE inline void Argmin_Macroblock(block_data &macroblock, const MSE_per_Macroblock &MSE_all_searches, int search_dist_x, int search_dist_y)
+{
+	int motion_vector_x_this_search = 0;
+	int motion_vector_y_this_search = 0;
+	//check all the possible search block pairs
+	for (int search_block = 0 ; search_block<9; search_block++)
+	{
+		//if the mse for the macroblock search block pair is less that the currently set
+		//mse, update the parameters for that macroblock
+		if(MSE_all_searches.block[search_block]<macroblock.MSE)
+		{
+			macroblock.MSE = MSE_all_searches.block[search_block];
+			motion_vector_x_this_search =  ((search_block%3)-1)*search_dist_x;
+			motion_vector_y_this_search =  ((search_block/3)-1)*search_dist_y;
+		}
+	}
+	macroblock.motion_vector_x = macroblock.motion_vector_x + motion_vector_x_this_search;
+	macroblock.motion_vector_y = macroblock.motion_vector_y + motion_vector_y_this_search;
+}
+
+//Class used to run the search steps of the block matching. The host orchestration in Block_Match only talks to
+//the backend through these functions, such that the same orchestration runs on the GPU or on the CPU.
+//All frame data is in the layout of Linearize_Image, and the backend keeps its own copy of the frames,
+//the macroblock data and the MSE of all the searches (in device memory for the GPU).
+//The macroblock data is only copied in before the first step and out after the last one: between steps it is
+//updated by Argmin_Step on the backend itself, so the steps are chained without the host.
+class Block_Match_Backend
+{
+public:
+	virtual ~Block_Match_Backend()
+	{
+	}
+
+	//Function used to give the backend the 2 linearized frames and allocate its buffers
+	//Inputs: linearized reference frame and frame to be predicted, frame size, number of macroblocks along x and y
+	//Output: None
+	virtual void Load_Frames(const int* frame_1, const int* frame_2, int rows, int cols, int channels, int blocks_x, int blocks_y) = 0;
+
+	//Function used to copy the initial macroblock data to the backend
+	virtual void Set_Macroblocks(const block_data* macroblocks) = 0;
+
+	//Function used to calculate the MSE of the 9 search blocks of every macroblock for one step
+	//Inputs: macroblock width and height, search distances of this step
+	//Output: None
+	virtual void Search_Step(int block_width, int block_height, int search_dist_x, int search_dist_y) = 0;
+
+	//Function used to move every macroblock to its search block with the lowest MSE, once a step is done
+	//Inputs: search distances of the step
+	//Output: None
+	virtual void Argmin_Step(int search_dist_x, int search_dist_y) = 0;
+
+	//Function used to copy the macroblock data (motion vectors and MSE) back from the backend
+	virtual void Get_Macroblocks(block_data* macroblocks) = 0;
+};
+
+//Function used to create the CPU backend, which evaluates all the search blocks of a step on all the cores
+//Inputs: number of threads to use (0 to use one per core)
+//Output: the backend, to be deleted by the caller
+Block_Match_Backend* Create_CPU_Backend(int threads);
+
+#endif
@@ -0,0 +1,159 @@
+#include "Block_Match.h"
+#include "Trace.h"
+#include "Scheduler.h"
+#include <vector>
+#include <thread>
+#include <cstring>
+#include <stdint.h>
+
+//CPU backend: mirrors the grid of Block_Match_Kernel, where every macroblock has 9 search blocks (9*blocks_x along x and
+//blocks_y along y). A task takes a chunk of macroblock rows and evaluates the 9 search blocks of every macroblock in them;
+//the chunks are run by a work stealing scheduler, such that a thread done with its chunks takes over those of a slower one.
+//Within a search block, a row of pixels is a contiguous run of block_width*channels integers in both frames, which the
+//compiler vectorizes; the squared differences are summed as integers so that the sum can be vectorized.
+class CPU_Backend : public Block_Match_Backend
+{
+public:
+	explicit CPU_Backend(int threads) :
+		scheduler(threads), rows(0), cols(0), channels(0), blocks_x(0), blocks_y(0)
+	{
+	}
+
+	void Load_Frames(const int* frame_1, const int* frame_2, int rows, int cols, int channels, int blocks_x, int blocks_y)
+	{
+		this->rows = rows;
+		this->cols = cols;
+		this->channels = channels;
+		this->blocks_x = blocks_x;
+		this->blocks_y = blocks_y;
+
+		this->frame_1.assign(frame_1, frame_1+rows*cols*channels);
+		this->frame_2.assign(frame_2, frame_2+rows*cols*channels);
+		macroblocks.resize(blocks_x*blocks_y);
+		MSE_all_searches.resize(blocks_x*blocks_y);
+	}
+
+	void Set_Macroblocks(const block_data* macroblocks)
+	{
+		std::memcpy(&this->macroblocks[0], macroblocks, blocks_x*blocks_y*sizeof(block_data));
+	}
+
+	void Search_Step(int block_width, int block_height, int search_dist_x, int search_dist_y)
+	{
+		Run_On_Rows(&CPU_Backend::Search_Rows, block_width, block_height, search_dist_x, search_dist_y);
+	}
+
+	void Argmin_Step(int search_dist_x, int search_dist_y)
+	{
+		Run_On_Rows(&CPU_Backend::Argmin_Rows, 0, 0, search_dist_x, search_dist_y);
+	}
+
+	void Get_Macroblocks(block_data* macroblocks)
+	{
+		std::memcpy(macroblocks, &this->macroblocks[0], blocks_x*blocks_y*sizeof(block_data));
+	}
+
+private:
+	typedef void (CPU_Backend::*Row_Function)(int row_start, int row_stop, int block_width, int block_height, int search_dist_x, int search_dist_y);
+
+	//Function used to split the macroblock rows into chunks run by the scheduler, about 8 chunks per thread
+	//Inputs: function to run on every chunk of rows, its block size and search distance parameters
+	//Output: None
+	void Run_On_Rows(Row_Function function, int block_width, int block_height, int search_dist_x, int search_dist_y)
+	{
+		int rows_per_task = blocks_y/(8*scheduler.get_threads());
+		if(rows_per_task < 1)
+		{
+			rows_per_task = 1;
+		}
+
+		Task_Group chunks;
+		for (int row_start = 0; row_start<blocks_y; row_start = row_start+rows_per_task)
+		{
+			int row_stop = (row_start+rows_per_task < blocks_y) ? row_start+rows_per_task : blocks_y;
+			scheduler.Submit(chunks, [=]()
+			{
+				(this->*function)(row_start, row_stop, block_width, block_height, search_dist_x, search_dist_y);
+			});
+		}
+		scheduler.Wait(chunks);
+	}
+
+	//Function used to update the macroblocks in a range of macroblock rows with their best search block (emulates Argmin_Kernel)
+	//Inputs: first and last (exclusive) macroblock row, unused block size, search distances of this step
+	//Output: None
+	void Argmin_Rows(int row_start, int row_stop, int, int, int search_dist_x, int search_dist_y)
+	{
+		TRACE_SCOPE("CPU Argmin Rows");
+		for (int index = row_start*blocks_x; index<row_stop*blocks_x; index++)
+		{
+			Argmin_Macroblock(macroblocks[index], MSE_all_searches[index], search_dist_x, search_dist_y);
+		}
+	}
+
+	//Function used to evaluate the 9 search blocks of every macroblock in a range of macroblock rows
+	//Inputs: first and last (exclusive) macroblock row, macroblock width and height, search distances of this step
+	//Output: None
+	void Search_Rows(int row_start, int row_stop, int block_width, int block_height, int search_dist_x, int search_dist_y)
+	{
+		TRACE_SCOPE("CPU Search Rows");
+		const int row_length = block_width*channels;
+		const int stride = cols*channels;
+
+		for (int y = row_start; y<row_stop; y++)
+		{
+			for (int x = 0; x<blocks_x; x++)
+			{
+				int macroblock_index = x+y*blocks_x;
+				const int* macroblock = &frame_2[(y*block_height*cols + x*block_width)*channels];
+
+				for (int search_block = 0; search_block<9; search_block++)
+				{
+					//the same search block co-ordinates as the kernel: search_block%3 gives the horizontal and
+					//search_block/3 the vertical position of the search block around the current motion vector
+					int search_area_x_start = macroblocks[macroblock_index].motion_vector_x + x*block_width + ((search_block%3)-1)*search_dist_x;
+					int search_area_y_start = macroblocks[macroblock_index].motion_vector_y + y*block_height + ((search_block/3)-1)*search_dist_y;
+
+					if((search_area_x_start < 0) || (search_area_x_start+block_width > cols) || (search_area_y_start < 0) || (search_area_y_start+block_height > rows))
+					{
+						MSE_all_searches[macroblock_index].block[search_block] = OUT_OF_BOUNDS_MSE;
+						continue;
+					}
+
+					const int* search = &frame_1[(search_area_y_start*cols + search_area_x_start)*channels];
+					int64_t MSE_pair = 0;
+					for (int row = 0; row<block_height; row++)
+					{
+						const int* macroblock_row = macroblock + row*stride;
+						const int* search_row = search + row*stride;
+						int row_sum = 0;
+						for (int i = 0; i<row_length; i++)
+						{
+							int difference = search_row[i] - macroblock_row[i];
+							row_sum = row_sum + difference*difference;
+						}
+						MSE_pair = MSE_pair + row_sum;
+					}
+
+					//normalized by the number of pixels, as in the kernel
+					MSE_all_searches[macroblock_index].block[search_block] = float(MSE_pair)/float(block_height*block_width);
+				}
+			}
+		}
+	}
+
+	Work_Stealing_Scheduler scheduler;
+	int rows, cols, channels;
+	int blocks_x, blocks_y;
+
+	//copies of the frames and results, standing in for the device memory
+	std::vector<int> frame_1;
+	std::vector<int> frame_2;
+	std::vector<block_data> macroblocks;
+	std::vector<MSE_per_Macroblock> MSE_all_searches;
+};
+
+Block_Match_Backend* Create_CPU_Backend(int threads)
+{
+	return new CPU_Backend(threads);
+}
@@ -1,34 +1,16 @@
 #include "jbutil.h"
+#include "Trace.h"
+#include "Block_Match.h"
+#include "MotionField.h"
+#include "Search_Steps.h"
 #include <vector>
 #include <limits>
 #include <istream>
 #include <cmath>
 #include <string>
+#include <cstring>
 #include <cuda.h>
 
-//struct to hold the motion vectors and MSE for each macroblock
-struct block_data
-{
-	int motion_vector_x;
-	int motion_vector_y;
-	float MSE;
-};
-
-//struct to hold the 9 MSE - Searchblock pairs
-struct MSE_per_Macroblock
-{
-	//0 -> top left block
-	//1 -> top centre block
-	//2 -> top right block
-	//3 -> middle left block
-	//4 -> middle centre block
-	//5 -> middle right left block
-	//6 -> bottom left block
-	//7 -> bottom centre block
-	//8 -> bottom right block
-	float block[9];
-};
-
 //Parameters for the algorithm: macroblock width and height and search area parameters
 int block_width = 8;
 int block_height = 8;
@@ -85,9 +67,9 @@ bool Load_Frames(std::string path, jbutil::image<int> &frame1,jbutil::image<int>
 	}
 
 //Function used to check the input parameters
-//Inputs: image used to check parameters
+//Inputs: image used to check parameters, whether the CUDA backend is used (which runs a thread per pixel of a block)
 //Output: True if all parameters are correct, False if not
-bool Parameter_Check(jbutil::image<int> &frame_1)
+bool Parameter_Check(jbutil::image<int> &frame_1, bool cuda)
 {
 	//checks to ensure that image width and height are exact multiplies of the block width and height
 	if(!(frame_1.get_cols()%block_width == 0))
@@ -106,7 +88,7 @@ bool Parameter_Check(jbutil::image<int> &frame_1)
 	}
 
 	//check to ensure that the number of threads in a block are less than 1024
-	if((block_width*block_height > 1024))
+	if(cuda && (block_width*block_height > 1024))
 	{
 		#ifndef NDEBUG
 			  std::cerr << "Error: Block Size defined is too large! \n" << std::flush;
@@ -128,12 +110,8 @@ void Modify_Image_Range(jbutil::image<int> &input, jbutil::image<int> &output, i
 		int row_count = 0;												//for the defined rows
 		for (int row = row_start; row<row_stop; row++)
 		{
-			int col_count = 0;
-			for(int col = col_start; col<col_stop; col++)				//for the defined columns
-			{
-				output(channel,output_row+row_count,output_col+col_count) = input(channel,row,col);	//set the range in the output image
-				col_count++;
-			}
+			//the columns of a row of a channel are contiguous, so the range of a row is copied at once
+			std::memcpy(&output(channel,output_row+row_count,output_col), &input(channel,row,col_start), (col_stop-col_start)*sizeof(int));
 			row_count++;
 		}
 	}
@@ -273,7 +251,7 @@ __global__ void Block_Match_Kernel(block_data* device_macroblocks, MSE_per_Macro
 		}
 		else
 		{
-			MSE_pair =50000000;
+			MSE_pair = OUT_OF_BOUNDS_MSE;
 		}
 
 		//write the MSE pair to a variable which will hold all the MSEs for all the macroblock and search block permutations
@@ -290,12 +268,134 @@ __global__ void Block_Match_Kernel(block_data* device_macroblocks, MSE_per_Macro
 
 }
 
-void Block_Match(jbutil::image<int> &frame_1,jbutil::image<int> &frame_2,jbutil::image<int> &reconstructed_frame2)
+//Kernel used to move every macroblock to its search block with the lowest MSE once a step is done,
+//such that the macroblock data stays on the device between steps. One thread per macroblock.
+__global__ void Argmin_Kernel(block_data* device_macroblocks, MSE_per_Macroblock* device_MSE_all_searches, int device_macroblock_count, int device_search_dist_x, int device_search_dist_y)
+{
+	int macroblock_index = blockIdx.x*blockDim.x+threadIdx.x;
+	if(macroblock_index < device_macroblock_count)
+	{
+		Argmin_Macroblock(device_macroblocks[macroblock_index], device_MSE_all_searches[macroblock_index], device_search_dist_x, device_search_dist_y);
+	}
+}
+
+//GPU backend: keeps the frames, macroblock data and MSE of all the searches in device memory and runs
+//Block_Match_Kernel for every step
+class CUDA_Backend : public Block_Match_Backend
+{
+public:
+	CUDA_Backend() :
+		device_frame_1(NULL), device_frame_2(NULL), device_macroblocks(NULL), device_MSE_all_searches(NULL), rows(0), cols(0), channels(0), blocks_x(0), blocks_y(0)
+	{
+	}
+
+	~CUDA_Backend()
+	{
+		//Free all the memory allocations
+		cudaFree(device_frame_1);
+		cudaFree(device_frame_2);
+		cudaFree(device_macroblocks);
+		cudaFree(device_MSE_all_searches);
+	}
+
+	void Load_Frames(const int* frame_1, const int* frame_2, int rows, int cols, int channels, int blocks_x, int blocks_y)
+	{
+		TRACE_SCOPE("Frames To Device");
+		this->rows = rows;
+		this->cols = cols;
+		this->channels = channels;
+		this->blocks_x = blocks_x;
+		this->blocks_y = blocks_y;
+
+		//allocate space for the frames on the device and pass them to the device
+		int array_size = rows*cols*channels;
+		cudaMalloc((void**)&device_frame_1, sizeof(int)*array_size);
+		cudaMemcpy(device_frame_1, frame_1, sizeof(int)*array_size, cudaMemcpyHostToDevice);
+		cudaMalloc((void**)&device_frame_2, sizeof(int)*array_size);
+		cudaMemcpy(device_frame_2, frame_2, sizeof(int)*array_size, cudaMemcpyHostToDevice);
+
+		//create the macroblock data and the macroblock - searchblock pair mse data structure for the device
+		cudaMalloc((void**)&device_macroblocks, blocks_x*blocks_y*sizeof(block_data));
+		cudaMalloc((void**)&device_MSE_all_searches, blocks_x*blocks_y*sizeof(MSE_per_Macroblock));
+	}
+
+	void Set_Macroblocks(const block_data* macroblocks)
+	{
+		TRACE_SCOPE("Macroblocks To Device");
+		cudaMemcpy(device_macroblocks, macroblocks, blocks_x*blocks_y*sizeof(block_data), cudaMemcpyHostToDevice);
+	}
+
+	void Search_Step(int block_width, int block_height, int search_dist_x, int search_dist_y)
+	{
+		TRACE_SCOPE("Block Match Kernel");
+
+		//call the kernel
+		dim3 Kernel_Blocks(9*blocks_x,blocks_y);
+		dim3 Threads_Per_Block(block_width,block_height);
+		Block_Match_Kernel<<<Kernel_Blocks,Threads_Per_Block, sizeof(float)*block_width*block_height>>>(device_macroblocks, device_MSE_all_searches, device_frame_1, device_frame_2, block_height, block_width, rows, cols, channels, search_dist_x, search_dist_y);
+
+		//the launch is asynchronous, so only wait for it when tracing, such that the span covers the kernel itself
+		if(Trace_Recorder::Instance().Enabled())
+		{
+			cudaDeviceSynchronize();
+		}
+	}
+
+	void Argmin_Step(int search_dist_x, int search_dist_y)
+	{
+		TRACE_SCOPE("Argmin Kernel");
+
+		const int Threads_Per_Block = 256;
+		int macroblock_count = blocks_x*blocks_y;
+		Argmin_Kernel<<<(macroblock_count+Threads_Per_Block-1)/Threads_Per_Block, Threads_Per_Block>>>(device_macroblocks, device_MSE_all_searches, macroblock_count, search_dist_x, search_dist_y);
+
+		if(Trace_Recorder::Instance().Enabled())
+		{
+			cudaDeviceSynchronize();
+		}
+	}
+
+	void Get_Macroblocks(block_data* macroblocks)
+	{
+		TRACE_SCOPE("Macroblocks To Host");
+		cudaMemcpy(macroblocks, device_macroblocks, blocks_x*blocks_y*sizeof(block_data), cudaMemcpyDeviceToHost);
+	}
+
+private:
+	int* device_frame_1;
+	int* device_frame_2;
+	block_data* device_macroblocks;
+	MSE_per_Macroblock* device_MSE_all_searches;
+	int rows, cols, channels;
+	int blocks_x, blocks_y;
+};
+
+//Function used to reconstruct a frame from a reference frame given the motion vectors of every macroblock
+//Inputs: reference frame, motion field, frame to be set
+//Output: None
+void Reconstruct_Frame(jbutil::image<int> &frame_1, const MotionField &field, jbutil::image<int> &reconstructed_frame2)
 {
-		//search dist parameters used in the three step search algorithm
-		int search_dist_x = search_horizontal/2;
-		int search_dist_y = search_vertical/2;
+	TRACE_SCOPE("Reconstruction");
+	for (int y = 0; y<field.get_blocks_y(); y++)
+	{
+		for (int x = 0; x<field.get_blocks_x(); x++)
+		{
+			int x_start = x*block_width+field.motion_vector_x(x,y);
+			int x_stop = x_start + block_width;
+
+			int y_start = y*block_height+field.motion_vector_y(x,y);
+			int y_stop = y_start + block_height;
+
+			Modify_Image_Range(frame_1, reconstructed_frame2, 0, reconstructed_frame2.channels(), x_start, x_stop, y_start,y_stop, x*block_width, y*block_height);
+		}
+	}
+}
 
+//Function to perform the block matching algorithm and call the kernel
+//Inputs: Reference Frame, Frame to be Predicted, motion field to be set, backend running the search steps
+//Output: None
+void Block_Match(jbutil::image<int> &frame_1,jbutil::image<int> &frame_2, MotionField &field, Block_Match_Backend &backend)
+{
 		//1st index = blocks along x, 2nd index => blocks along y
 		//This 2D array will contain motion vectors in the x and y directions and MSE for each macroblock in the image
 		blocks_x = frame_1.get_cols()/block_width;
@@ -304,9 +404,6 @@ void Block_Match(jbutil::image<int> &frame_1,jbutil::image<int> &frame_2,jbutil:
 		//The following holds the MSE and motion vector for each macroblock in a linear manner
 		block_data* macroblocks = (block_data*)malloc(blocks_x*blocks_y*sizeof(block_data));
 
-		//The following holds the MSE for all the search blocks for every macroblock in a linear manner
-		MSE_per_Macroblock* MSE_all_searches = (MSE_per_Macroblock*)malloc(blocks_x*blocks_y*sizeof(MSE_per_Macroblock));
-
 
 		//Initialisation of the parmeters for each block
 		for (int x = 0; x<blocks_x; x++)
@@ -317,11 +414,6 @@ void Block_Match(jbutil::image<int> &frame_1,jbutil::image<int> &frame_2,jbutil:
 				macroblocks[index].motion_vector_x = 0;
 				macroblocks[index].motion_vector_y = 0;
 				macroblocks[index].MSE = std::numeric_limits<float>::max();
-
-				for (int search = 0; search<9; search++)
-				{
-					MSE_all_searches[index].block[search] = 0;
-				}
 			}
 		}
 
@@ -331,136 +423,97 @@ void Block_Match(jbutil::image<int> &frame_1,jbutil::image<int> &frame_2,jbutil:
 		int channels = frame_1.channels();
 
 
-		//Linearize the images, allocate space for them on the device and pass them to the device
+		//Linearize the images and pass them to the backend
 		int array_size = frame_1.get_cols()*frame_1.get_rows()*frame_1.channels();
 
 		int* array_frame_1 = (int*)std::malloc(sizeof(int)*array_size);
-		Linearize_Image(frame_1, array_frame_1);
-		int* device_frame_1;
-		cudaMalloc((void**)&device_frame_1, sizeof(int)*array_size);
-		cudaMemcpy(device_frame_1, array_frame_1, sizeof(int)*array_size, cudaMemcpyHostToDevice);
-
 		int* array_frame_2 = (int*)std::malloc(sizeof(int)*array_size);
-		Linearize_Image(frame_2, array_frame_2);
-		int* device_frame_2;
-		cudaMalloc((void**)&device_frame_2, sizeof(int)*array_size);
-		cudaMemcpy(device_frame_2, array_frame_2, sizeof(int)*array_size, cudaMemcpyHostToDevice);
-
-		//create the macroblock data for the device and allocate space
-		block_data* device_macroblocks;
-		cudaMalloc((void**)&device_macroblocks, blocks_x*blocks_y*sizeof(block_data));
-
-		//create the the macroblock - searchblock pair mse data structure for the device and copy to device
-		MSE_per_Macroblock* device_MSE_all_searches;
-		cudaMalloc((void**)&device_MSE_all_searches, blocks_x*blocks_y*sizeof(MSE_per_Macroblock));
-		cudaMemcpy(device_MSE_all_searches, MSE_all_searches, blocks_x*blocks_y*sizeof(MSE_per_Macroblock), cudaMemcpyHostToDevice);
-
-
-		for (int search_count = 0; search_count<3;search_count++)	//for loop to denote the step in which the 3 step search has reached
 		{
-			//copy over the macroblock data. this must be done here since this data changes per iteration
-			cudaMemcpy(device_macroblocks, macroblocks, blocks_x*blocks_y*sizeof(block_data), cudaMemcpyHostToDevice);
-
-			//call the kernel
-			dim3 Kernel_Blocks(9*blocks_x,blocks_y);
-			dim3 Threads_Per_Block(block_width,block_height);
-
-			Block_Match_Kernel<<<Kernel_Blocks,Threads_Per_Block, sizeof(float)*block_width*block_height>>>(device_macroblocks, device_MSE_all_searches, device_frame_1, device_frame_2, block_height, block_width, rows, cols, channels, search_dist_x, search_dist_y);
-
-			//copy back the results
-			cudaMemcpy(MSE_all_searches, device_MSE_all_searches, blocks_x*blocks_y*sizeof(MSE_per_Macroblock), cudaMemcpyDeviceToHost);
-
-
-			//for every macroblock
-			for (int x = 0; x<blocks_x; x++)
-			{
-				for (int y = 0; y<blocks_y; y++)
-				{
-					int index = x+y*blocks_x;
-					int motion_vector_x_this_search = 0;
-					int motion_vector_y_this_search = 0;
-					//check all the possible search block pairs
-					for (int search_block = 0 ; search_block<9; search_block++)
-					{
-						//if the mse for the macroblock search block pair is less that the currently set
-						//mse, update the parameters for that macroblock
-						//NB: MSE_all searches = 9*number of macroblocks, where:
-							//index%8 = 0 -> top left block
-							//index%8 = 1 -> top centre block
-							//index%8 = 2 -> top right block
-							//index%8 = 3 -> middle left block
-							//index%8 = 4 -> middle centre block
-							//index%8 = 5 -> middle right left block
-							//index%8 = 6 -> bottom left block
-							//index%8 = 7 -> bottom centre block
-							//index%8 = 8 -> bottom right block
-
-						if(MSE_all_searches[index].block[search_block]<macroblocks[index].MSE)
-						{
-							macroblocks[index].MSE = MSE_all_searches[index].block[search_block];
-							motion_vector_x_this_search =  ((search_block%3)-1)*search_dist_x;
-							motion_vector_y_this_search =  ((search_block/3)-1)*search_dist_y;
-						}
-
-					}
-					macroblocks[index].motion_vector_x = macroblocks[index].motion_vector_x + motion_vector_x_this_search;
-					macroblocks[index].motion_vector_y = macroblocks[index].motion_vector_y + motion_vector_y_this_search;
+			TRACE_SCOPE("Linearize");
+			Linearize_Image(frame_1, array_frame_1);
+			Linearize_Image(frame_2, array_frame_2);
+		}
 
-				}
-			}
+		backend.Load_Frames(array_frame_1, array_frame_2, rows, cols, channels, blocks_x, blocks_y);
 
-			//Update also the search dist parameters to get finer searches.
-			//After 3 iterations, they should be set to 1 such that macroblocks differ by 1 pixel
-			if(search_count == 1)
-			{
-				search_dist_x = 1;
-				search_dist_y = 1;
-			}
-			else if(search_count != 2)
-			{
-				//using fast ceil - must be done since no guarantee division will result in exact multiples
-				search_dist_x = int((search_dist_x+(search_dist_x/2)-1)/((search_dist_x/2)));
-				search_dist_y = int((search_dist_y+(search_dist_y/2)-1)/((search_dist_y/2)));
-			}
 
-		}
+		//copy over the macroblock data. The steps update it on the backend, so it is only copied back once they are all done
+		backend.Set_Macroblocks(macroblocks);
 
-		//Once the process is done, reconstruct the image
-		for (int y = 0; y<blocks_y; y++)
+		//the logarithmic search: ceil(log2(range)) steps with the step distance halved at every step, which are the
+		//three steps 4, 2, 1 of the three step search for a range of 8
+		const int steps = Get_Step_Count(search_horizontal, search_vertical);
+		for (int search_count = 0; search_count<steps; search_count++)
 		{
-			for (int x = 0; x<blocks_x; x++)
-			{
+			TRACE_SCOPE_ARG("Search Step", search_count);
+			const int search_dist_x = Get_Step_Distance(search_horizontal, search_count);
+			const int search_dist_y = Get_Step_Distance(search_vertical, search_count);
 
-				int index = x+y*blocks_x;
-				int x_start = x*block_width+macroblocks[index].motion_vector_x;
-				int x_stop = x_start + block_width;
+			//evaluate the 9 search blocks of every macroblock
+			backend.Search_Step(block_width, block_height, search_dist_x, search_dist_y);
 
-				int y_start = y*block_height+macroblocks[index].motion_vector_y;
-				int y_stop = y_start + block_height;
+			//move every macroblock to its search block with the lowest MSE
+			backend.Argmin_Step(search_dist_x, search_dist_y);
+		}
 
-				Modify_Image_Range(frame_1, reconstructed_frame2, 0, reconstructed_frame2.channels(), x_start, x_stop, y_start,y_stop, x*block_width, y*block_height);
+		backend.Get_Macroblocks(macroblocks);
 
-			}
+		//Once the process is done, move the results to the motion field. The kernel normalizes the MSE by the
+		//number of pixels, so the cost (sum of squared errors) is recovered by multiplying it back
+		field.resize(blocks_x, blocks_y, true);
+		int16_t* motion_vectors_x = field.motion_vector_x_plane();
+		int16_t* motion_vectors_y = field.motion_vector_y_plane();
+		uint32_t* costs = field.cost_plane();
+		for (int index = 0; index<blocks_x*blocks_y; index++)
+		{
+			motion_vectors_x[index] = int16_t(macroblocks[index].motion_vector_x);
+			motion_vectors_y[index] = int16_t(macroblocks[index].motion_vector_y);
+			costs[index] = uint32_t(macroblocks[index].MSE*float(block_width*block_height)+0.5f);
 		}
 
-
 		//Free all the memory allocations
-		cudaFree(device_frame_1);
-		cudaFree(device_frame_2);
-		cudaFree(device_macroblocks);
-		cudaFree(device_MSE_all_searches);
-
 		std::free(array_frame_1);
 		std::free(array_frame_2);
 		std::free(macroblocks);
-		std::free(MSE_all_searches);
 }
 
 
+//Function used to read the optional arguments, given as --name=value after the positional ones
+//Inputs: argument count and values, index of the first optional argument, path of the trace file, backend name
+//        and number of CPU threads to be set
+//Output: True if all the optional arguments are known, False if not
+bool Parse_Options(int argc, char* argv[], int first, std::string &trace_path, std::string &backend, int &threads)
+{
+	for (int arg = first; arg<argc; arg++)
+	{
+		std::string option(argv[arg]);
+		if(option.compare(0, 8, "--trace=") == 0)
+		{
+			trace_path = option.substr(8);
+		}
+		else if(option.compare(0, 10, "--backend=") == 0)
+		{
+			backend = option.substr(10);
+		}
+		else if(option.compare(0, 10, "--threads=") == 0)
+		{
+			threads = atoi(option.substr(10).c_str());
+		}
+		else
+		{
+			#ifndef NDEBUG
+				std::cerr << "Unknown option: " << option << "\n" << std::flush;
+			#endif
+			return false;
+		}
+	}
+	return true;
+}
+
 //Main Function
 int main(int argc, char* argv[])
 {
-	if(argc!=6)
+	if(argc<6)
 	{
 		#ifndef NDEBUG
 			  std::cerr << "Not enough input arguments\n" << std::flush;
@@ -474,10 +527,59 @@ int main(int argc, char* argv[])
 	search_horizontal 	= atoi(argv[4]);
 	std::string path(argv[5]);
 
-	if((block_width == 0) || (block_height == 0) || (search_vertical == 0) || (search_horizontal == 0))
+	if((block_width == 0) || (block_height == 0) || (search_vertical < 1) || (search_horizontal < 1))
 	{
 		#ifndef NDEBUG
-			std::cerr<<"Integer parameters must be non-zero \n"<<std::flush;
+			std::cerr<<"Integer parameters must be non-zero, and the search ranges positive \n"<<std::flush;
+		#endif
+		return 0;
+	}
+
+	//Optional arguments
+	std::string trace_path;
+	std::string backend_name;
+	int threads = 0;
+	if(!Parse_Options(argc, argv, 6, trace_path, backend_name, threads))
+	{
+		return 0;
+	}
+
+	//the steps of a range which is a power of two add up to one pixel less than the range
+	#ifndef NDEBUG
+	{
+		const int steps = Get_Step_Count(search_horizontal, search_vertical);
+		if((Get_Search_Reach(search_vertical, steps) < search_vertical) || (Get_Search_Reach(search_horizontal, steps) < search_horizontal))
+		{
+			std::cerr << "Search Reach: " << Get_Search_Reach(search_vertical, steps) << " x " << Get_Search_Reach(search_horizontal, steps) << " pixels \n" << std::flush;
+		}
+	}
+	#endif
+
+	//if no backend is chosen, the GPU is used when there is one
+	if(backend_name.empty())
+	{
+		int devices = 0;
+		backend_name = ((cudaGetDeviceCount(&devices) == cudaSuccess) && (devices > 0)) ? "cuda" : "cpu";
+	}
+
+	if(!trace_path.empty())
+	{
+		Trace_Recorder::Instance().Enable();
+	}
+
+	Block_Match_Backend* backend;
+	if(backend_name == "cuda")
+	{
+		backend = new CUDA_Backend();
+	}
+	else if(backend_name == "cpu")
+	{
+		backend = Create_CPU_Backend(threads);
+	}
+	else
+	{
+		#ifndef NDEBUG
+			std::cerr << "Unknown backend: " << backend_name << "\n" << std::flush;
 		#endif
 		return 0;
 	}
@@ -488,18 +590,22 @@ int main(int argc, char* argv[])
 
 
 	//load frames
-	if(!Load_Frames(path, frame1, frame2))
 	{
-		return 0;
+		TRACE_SCOPE("Load");
+		if(!Load_Frames(path, frame1, frame2))
+		{
+			return 0;
+		}
 	}
 
 	//check the frames and parameters
-	if(!Parameter_Check(frame1))
+	if(!Parameter_Check(frame1, backend_name == "cuda"))
 	{
 		return 0;
 	}
 
-	//Object to hold the reconstructed frame 2
+	//Objects to hold the motion vectors and the reconstructed frame 2
+	MotionField motion_field;
 	jbutil::image<int> reconstructed_frame2(frame2.get_rows(),frame2.get_cols(),frame2.channels());
 
 	#ifndef NDEBUG
@@ -507,9 +613,13 @@ int main(int argc, char* argv[])
 	#endif
 
 	//Run the Block Matching and Reconstruction
-	double t = jbutil::gettime();
-	Block_Match(frame1, frame2, reconstructed_frame2);
-	t = jbutil::gettime() - t;
+	double t = Trace_Seconds();
+	{
+		TRACE_SCOPE("Block Match");
+		Block_Match(frame1, frame2, motion_field, *backend);
+		Reconstruct_Frame(frame1, motion_field, reconstructed_frame2);
+	}
+	t = Trace_Seconds() - t;
 
 	std::cout << "Total Time taken: " << t << "s" << std::endl;
 	#ifndef NDEBUG
@@ -519,9 +629,21 @@ int main(int argc, char* argv[])
 	#ifndef NDEBUG
 		  std::cerr << "Saving Reconstructed Frame\n" << std::flush;
 	#endif
-	std::ofstream output;
-	output.open((path+std::string("/Reconstructed_Frame.ppm")).c_str());
-	reconstructed_frame2.save(output);
+	{
+		TRACE_SCOPE("Save");
+		std::ofstream output;
+		output.open((path+std::string("/Reconstructed_Frame.ppm")).c_str());
+		reconstructed_frame2.save(output);
+	}
+
+	delete backend;
+
+	if(!trace_path.empty() && !Trace_Recorder::Instance().Save(trace_path))
+	{
+		#ifndef NDEBUG
+			std::cerr << "Error Saving Trace \n" << std::flush;
+		#endif
+	}
 
 	return 0;
 }
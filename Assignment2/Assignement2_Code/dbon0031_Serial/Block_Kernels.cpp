@@ -0,0 +1,289 @@
+#include "Block_Kernels.h"
+
+void Linearize_Image(const jbutil::image<int> &image, Linear_Frame &frame)
+{
+	frame.resize(image.get_rows(), image.get_cols(), image.channels());
+
+	//linearize the image such that the channels of a pixel, and the pixels of a row, are adjacent: every row of a
+	//channel is contiguous in the image, and is interleaved with the same row of the other channels
+	const int channels = frame.channels;
+	for (int row = 0; (row<frame.rows) && (frame.cols > 0); row++)
+	{
+		int* output = frame.pixel(row, 0);
+		for(int channel = 0; channel<channels; channel++)
+		{
+			const int* input = &image(channel,row,0);
+			for(int col = 0; col<frame.cols; col++)
+			{
+				output[col*channels+channel] = input[col];
+			}
+		}
+	}
+}
+
+void Delinearize_Image(const Linear_Frame &frame, jbutil::image<int> &image)
+{
+	Delinearize_Rows(frame, 0, frame.rows, image);
+}
+
+void Delinearize_Rows(const Linear_Frame &frame, int row_start, int row_stop, jbutil::image<int> &image)
+{
+	assert(image.get_rows() == frame.rows && image.get_cols() == frame.cols && image.channels() == frame.channels);
+
+	const int channels = frame.channels;
+	for (int row = row_start; (row<row_stop) && (frame.cols > 0); row++)
+	{
+		const int* input = frame.pixel(row, 0);
+		for(int channel = 0; channel<channels; channel++)
+		{
+			int* output = &image(channel,row,0);
+			for(int col = 0; col<frame.cols; col++)
+			{
+				output[col] = input[col*channels+channel];
+			}
+		}
+	}
+}
+
+//Generic kernels, used for the block sizes which do not have a specialized version
+
+static uint32_t SSE_Generic(const int* block, const int* search, int search_stride, int width, int height, int channels)
+{
+	const int row_length = width*channels;
+
+	uint32_t SSE = 0;
+	for (int row = 0; row<height; row++)
+	{
+		const int* block_row = block + row*row_length;
+		const int* search_row = search + row*search_stride;
+		for (int i = 0; i<row_length; i++)
+		{
+			int difference = block_row[i] - search_row[i];
+			SSE = SSE + uint32_t(difference*difference);
+		}
+	}
+	return SSE;
+}
+
+static void Set_Block_Generic(const int* input, int input_stride, int* block, int width, int height, int channels)
+{
+	const int row_length = width*channels;
+	for (int row = 0; row<height; row++)
+	{
+		for (int i = 0; i<row_length; i++)
+		{
+			block[row*row_length+i] = input[row*input_stride+i];
+		}
+	}
+}
+
+#define FIXED_KERNELS(size, channels) {&Set_Block_Fixed<size,size,channels>}
+
+//Dispatch table: the sizes which are specialized, and their kernels for 1 and 3 channels
+static const int fixed_sizes[4] = {4, 8, 16, 32};
+static const Block_Kernels fixed_kernels[4][2] =
+{
+	{FIXED_KERNELS(4, 1),  FIXED_KERNELS(4, 3)},
+	{FIXED_KERNELS(8, 1),  FIXED_KERNELS(8, 3)},
+	{FIXED_KERNELS(16, 1), FIXED_KERNELS(16, 3)},
+	{FIXED_KERNELS(32, 1), FIXED_KERNELS(32, 3)}
+};
+static const Block_Kernels generic_kernels = {&Set_Block_Generic};
+
+const Block_Kernels& Get_Block_Kernels(int width, int height, int channels)
+{
+	if((width == height) && ((channels == 1) || (channels == 3)))
+	{
+		for (int size = 0; size<4; size++)
+		{
+			if(fixed_sizes[size] == width)
+			{
+				return fixed_kernels[size][channels == 3];
+			}
+		}
+	}
+	return generic_kernels;
+}
+
+//Generic cost kernels of the other metrics
+static uint32_t SAD_Generic(const int* block, const int* search, int search_stride, int width, int height, int channels)
+{
+	const int row_length = width*channels;
+	uint32_t SAD = 0;
+	for (int row = 0; row<height; row++)
+	{
+		const int* block_row = block + row*row_length;
+		const int* search_row = search + row*search_stride;
+		for (int i = 0; i<row_length; i++)
+		{
+			int difference = block_row[i] - search_row[i];
+			SAD = SAD + uint32_t(difference < 0 ? -difference : difference);
+		}
+	}
+	return SAD;
+}
+
+template <int SIZE>
+static uint32_t SATD_Generic(const int* block, const int* search, int search_stride, int width, int height, int channels)
+{
+	const int row_length = width*channels;
+	uint32_t SATD = 0;
+	for (int row = 0; row<height; row = row+SIZE)
+	{
+		for (int col = 0; col<width; col = col+SIZE)
+		{
+			//the Hadamard transform of every channel of the sub-block, as in SATD_Fixed
+			uint32_t sub_block = 0;
+			for (int channel = 0; channel<channels; channel++)
+			{
+				int difference[SIZE][SIZE];
+				for (int y = 0; y<SIZE; y++)
+				{
+					for (int x = 0; x<SIZE; x++)
+					{
+						difference[y][x] = block[(row+y)*row_length + (col+x)*channels + channel] - search[(row+y)*search_stride + (col+x)*channels + channel];
+					}
+				}
+				for (int half_span = 1; half_span<SIZE; half_span = half_span*2)
+				{
+					for (int start = 0; start<SIZE; start = start+2*half_span)
+					{
+						for (int i = start; i<start+half_span; i++)
+						{
+							for (int j = 0; j<SIZE; j++)
+							{
+								int a = difference[i][j];
+								int b = difference[i+half_span][j];
+								difference[i][j] = a + b;
+								difference[i+half_span][j] = a - b;
+							}
+						}
+					}
+				}
+				for (int half_span = 1; half_span<SIZE; half_span = half_span*2)
+				{
+					for (int start = 0; start<SIZE; start = start+2*half_span)
+					{
+						for (int j = start; j<start+half_span; j++)
+						{
+							for (int i = 0; i<SIZE; i++)
+							{
+								int a = difference[i][j];
+								int b = difference[i][j+half_span];
+								difference[i][j] = a + b;
+								difference[i][j+half_span] = a - b;
+							}
+						}
+					}
+				}
+				for (int y = 0; y<SIZE; y++)
+				{
+					for (int x = 0; x<SIZE; x++)
+					{
+						sub_block = sub_block + uint32_t(difference[y][x] < 0 ? -difference[y][x] : difference[y][x]);
+					}
+				}
+			}
+			SATD = SATD + ((SIZE == 4) ? (sub_block+1)/2 : (sub_block+2)/4);
+		}
+	}
+	return SATD;
+}
+
+#define FIXED_COST_KERNELS(size, channels) {&SSE_Fixed<size,size,channels>, &SAD_Fixed<size,size,channels>, \
+		&SATD_Fixed<4,size,size,channels>, &SATD_Fixed<8,size,size,channels>}
+
+//Dispatch table: the cost kernels of the specialized sizes for every metric, for 1 and 3 channels. A 4x4 block has no
+//8x8 SATD (rejected by the motion estimator), so the generic kernel fills its place.
+static const Cost_Kernel fixed_cost_kernels[4][2][4] =
+{
+	{{&SSE_Fixed<4,4,1>, &SAD_Fixed<4,4,1>, &SATD_Fixed<4,4,4,1>, &SATD_Generic<8>},
+	 {&SSE_Fixed<4,4,3>, &SAD_Fixed<4,4,3>, &SATD_Fixed<4,4,4,3>, &SATD_Generic<8>}},
+	{FIXED_COST_KERNELS(8, 1),  FIXED_COST_KERNELS(8, 3)},
+	{FIXED_COST_KERNELS(16, 1), FIXED_COST_KERNELS(16, 3)},
+	{FIXED_COST_KERNELS(32, 1), FIXED_COST_KERNELS(32, 3)}
+};
+static const Cost_Kernel generic_cost_kernels[4] = {&SSE_Generic, &SAD_Generic, &SATD_Generic<4>, &SATD_Generic<8>};
+
+Cost_Kernel Get_Cost_Kernel(int width, int height, int channels, Cost_Metric metric)
+{
+	if((width == height) && ((channels == 1) || (channels == 3)))
+	{
+		for (int size = 0; size<4; size++)
+		{
+			if(fixed_sizes[size] == width)
+			{
+				return fixed_cost_kernels[size][channels == 3][metric];
+			}
+		}
+	}
+	return generic_cost_kernels[metric];
+}
+
+//Batch cost kernel of the SATD and of the generic sizes: the cost kernel is called for every search block
+template <Cost_Kernel KERNEL>
+static int Batch_Cost_Single(const int* block, const int* const* search, int count, int search_stride, int width, int height, int channels,
+		const uint32_t* rates, uint32_t &least_cost)
+{
+	uint32_t costs[MAX_CANDIDATES] = {};
+	for (int candidate = 0; candidate<count; candidate++)
+	{
+		costs[candidate] = KERNEL(block, search[candidate], search_stride, width, height, channels) + rates[candidate];
+	}
+	return Least_Cost(costs, count, least_cost);
+}
+
+#define FIXED_BATCH_COST_KERNELS(size, channels) {&Batch_Cost_Fixed<size,size,channels,true>, &Batch_Cost_Fixed<size,size,channels,false>, \
+		&Batch_Cost_Single<&SATD_Fixed<4,size,size,channels> >, &Batch_Cost_Single<&SATD_Fixed<8,size,size,channels> >}
+
+//Dispatch table: the batch cost kernels of the specialized sizes, laid out as fixed_cost_kernels
+static const Batch_Cost_Kernel fixed_batch_cost_kernels[4][2][4] =
+{
+	{{&Batch_Cost_Fixed<4,4,1,true>, &Batch_Cost_Fixed<4,4,1,false>, &Batch_Cost_Single<&SATD_Fixed<4,4,4,1> >, &Batch_Cost_Single<&SATD_Generic<8> >},
+	 {&Batch_Cost_Fixed<4,4,3,true>, &Batch_Cost_Fixed<4,4,3,false>, &Batch_Cost_Single<&SATD_Fixed<4,4,4,3> >, &Batch_Cost_Single<&SATD_Generic<8> >}},
+	{FIXED_BATCH_COST_KERNELS(8, 1),  FIXED_BATCH_COST_KERNELS(8, 3)},
+	{FIXED_BATCH_COST_KERNELS(16, 1), FIXED_BATCH_COST_KERNELS(16, 3)},
+	{FIXED_BATCH_COST_KERNELS(32, 1), FIXED_BATCH_COST_KERNELS(32, 3)}
+};
+static const Batch_Cost_Kernel generic_batch_cost_kernels[4] = {&Batch_Cost_Single<&SSE_Generic>, &Batch_Cost_Single<&SAD_Generic>,
+		&Batch_Cost_Single<&SATD_Generic<4> >, &Batch_Cost_Single<&SATD_Generic<8> >};
+
+Batch_Cost_Kernel Get_Batch_Cost_Kernel(int width, int height, int channels, Cost_Metric metric)
+{
+	if((width == height) && ((channels == 1) || (channels == 3)))
+	{
+		for (int size = 0; size<4; size++)
+		{
+			if(fixed_sizes[size] == width)
+			{
+				return fixed_batch_cost_kernels[size][channels == 3][metric];
+			}
+		}
+	}
+	return generic_batch_cost_kernels[metric];
+}
+
+//Dispatch table: the SSE and SAD kernels for every other row of the specialized sizes, for 1 and 3 channels
+static const Cost_Kernel decimated_cost_kernels[4][2][2] =
+{
+	{{&SSE_Fixed<4,2,1>,   &SAD_Fixed<4,2,1>},   {&SSE_Fixed<4,2,3>,   &SAD_Fixed<4,2,3>}},
+	{{&SSE_Fixed<8,4,1>,   &SAD_Fixed<8,4,1>},   {&SSE_Fixed<8,4,3>,   &SAD_Fixed<8,4,3>}},
+	{{&SSE_Fixed<16,8,1>,  &SAD_Fixed<16,8,1>},  {&SSE_Fixed<16,8,3>,  &SAD_Fixed<16,8,3>}},
+	{{&SSE_Fixed<32,16,1>, &SAD_Fixed<32,16,1>}, {&SSE_Fixed<32,16,3>, &SAD_Fixed<32,16,3>}}
+};
+
+Cost_Kernel Get_Decimated_Cost_Kernel(int width, int height, int channels, Cost_Metric metric)
+{
+	const int sad = (metric != METRIC_SSD);
+	if((width == height) && ((channels == 1) || (channels == 3)))
+	{
+		for (int size = 0; size<4; size++)
+		{
+			if(fixed_sizes[size] == width)
+			{
+				return decimated_cost_kernels[size][channels == 3][sad];
+			}
+		}
+	}
+	return sad ? &SAD_Generic : &SSE_Generic;
+}
@@ -0,0 +1,297 @@
+#ifndef __Block_Kernels_h
+#define __Block_Kernels_h
+
+#include "jbutil.h"
+#include <stdint.h>
+
+//struct to hold a linearized image: row by row, pixel by pixel and channel by channel (the layout of Linearize_Image),
+//such that a row of a block is a single run of block_width*channels integers
+struct Linear_Frame
+{
+	jbutil::vector<int> data;
+	int rows;
+	int cols;
+	int channels;
+
+	//first frame row held in data: a frame can hold a window of its rows only (strip streaming), in which case the
+	//rows outside the window must not be accessed
+	int row_offset;
+
+	Linear_Frame() : rows(0), cols(0), channels(0), row_offset(0)
+	{
+	}
+
+	void resize(int rows, int cols, int channels)
+	{
+		resize_window(rows, cols, channels, rows);
+	}
+
+	//Function used to size a frame of rows*cols pixels to hold a window of window_rows of its rows, starting at row 0
+	void resize_window(int rows, int cols, int channels, int window_rows)
+	{
+		this->rows = rows;
+		this->cols = cols;
+		this->channels = channels;
+		row_offset = 0;
+		data.resize(window_rows*cols*channels);
+	}
+
+	//number of integers between vertically adjacent pixels
+	int stride() const
+	{
+		return cols*channels;
+	}
+
+	//pointer to the first channel of a pixel
+	int* pixel(int row, int col)
+	{
+		return &data[((row-row_offset)*cols+col)*channels];
+	}
+	const int* pixel(int row, int col) const
+	{
+		return &data[((row-row_offset)*cols+col)*channels];
+	}
+};
+
+//Function to perform the linearization of the image
+//Inputs: Image to be linearized, output frame (resized if needed)
+//Output: None
+void Linearize_Image(const jbutil::image<int> &image, Linear_Frame &frame);
+
+//Function to copy a linearized frame back to an image of the same size
+//Inputs: linearized frame, image to be set
+//Output: None
+void Delinearize_Image(const Linear_Frame &frame, jbutil::image<int> &image);
+
+//the same for a range of rows
+//Inputs: linearized frame, first and last (exclusive) row, image to be set
+void Delinearize_Rows(const Linear_Frame &frame, int row_start, int row_stop, jbutil::image<int> &image);
+
+//The metrics with which a search block can be compared with a macroblock
+enum Cost_Metric
+{
+	METRIC_SSD,			//sum of squared differences (the Mean Square Error multiplied by the number of samples)
+	METRIC_SAD,			//sum of absolute differences
+	METRIC_SATD_4,		//sum of the absolute 4x4 Hadamard transformed differences, halved for every sub-block
+	METRIC_SATD_8		//the same with 8x8 transforms, divided by 4 for every sub-block
+};
+
+//Function pointers for the per-block kernels. Blocks are given by a pointer to their top left pixel and
+//a stride; a packed block (as set by Set_Block) has a stride of width*channels.
+//Cost:   distortion between a packed block and a block in a frame with one of the metrics, summed as integers such
+//        that it is exact for 8-bit samples (METRIC_SSD gives the sum of squared errors)
+//Set:    copies a block of a frame into a packed block (replaces Set_Image_Range)
+typedef uint32_t (*Cost_Kernel)(const int* block, const int* search, int search_stride, int width, int height, int channels);
+typedef void (*Set_Kernel)(const int* input, int input_stride, int* block, int width, int height, int channels);
+
+//Batch cost kernel: the costs of up to MAX_CANDIDATES search blocks (given by pointers to their top left pixel, all with
+//the same stride) are computed in one call, which replaces a call through a Cost_Kernel per search block. A rate is
+//added to every cost, and the index of the search block with the least cost is returned (the first among equal costs),
+//its cost being set in least_cost.
+const int MAX_CANDIDATES = 9;
+typedef int (*Batch_Cost_Kernel)(const int* block, const int* const* search, int count, int search_stride, int width, int height, int channels,
+		const uint32_t* rates, uint32_t &least_cost);
+
+//struct to hold the kernels used for one block size
+struct Block_Kernels
+{
+	Set_Kernel Set_Block;
+};
+
+//Function used to get the kernels for a block size: 4x4, 8x8, 16x16 and 32x32 blocks with 1 or 3 channels
+//use kernels specialized at compile time, any other size uses the generic kernels
+//Inputs: block width and height, number of channels
+//Output: the kernels to be used
+const Block_Kernels& Get_Block_Kernels(int width, int height, int channels);
+
+//Function used to get the cost kernel of a metric, specialized at compile time for the same block sizes as
+//Get_Block_Kernels. The width and height must be multiples of 4 for METRIC_SATD_4 and of 8 for METRIC_SATD_8.
+//Inputs: block width and height, number of channels, metric
+//Output: the kernel to be used
+Cost_Kernel Get_Cost_Kernel(int width, int height, int channels, Cost_Metric metric);
+
+//Function used to get the batch cost kernel of a metric, for the same block sizes as Get_Cost_Kernel
+//Inputs: block width and height, number of channels, metric
+//Output: the kernel to be used
+Batch_Cost_Kernel Get_Batch_Cost_Kernel(int width, int height, int channels, Cost_Metric metric);
+
+//Function used to get the cost kernel for every other row of a block (a block of half its height, read with twice the
+//stride): the SSE for METRIC_SSD and the SAD for the other metrics, as the rows of a transform cannot be skipped
+//Inputs: block width and height (of the whole block), number of channels, metric
+//Output: the kernel to be used
+Cost_Kernel Get_Decimated_Cost_Kernel(int width, int height, int channels, Cost_Metric metric);
+
+//Kernels with the block size fixed at compile time, such that every loop has a constant trip count and can be
+//fully unrolled and vectorized by the compiler. The runtime size parameters are ignored.
+template <int WIDTH, int HEIGHT, int CHANNELS>
+uint32_t SSE_Fixed(const int* block, const int* search, int search_stride, int, int, int)
+{
+	const int row_length = WIDTH*CHANNELS;
+
+	//one accumulator per integer in a row, summed once all the rows are done
+	uint32_t accumulator[row_length] = {};
+	for (int row = 0; row<HEIGHT; row++)
+	{
+		const int* block_row = block + row*row_length;
+		const int* search_row = search + row*search_stride;
+		for (int i = 0; i<row_length; i++)
+		{
+			int difference = block_row[i] - search_row[i];
+			accumulator[i] = accumulator[i] + uint32_t(difference*difference);
+		}
+	}
+
+	uint32_t SSE = 0;
+	for (int i = 0; i<row_length; i++)
+	{
+		SSE = SSE + accumulator[i];
+	}
+	return SSE;
+}
+
+template <int WIDTH, int HEIGHT, int CHANNELS>
+uint32_t SAD_Fixed(const int* block, const int* search, int search_stride, int, int, int)
+{
+	const int row_length = WIDTH*CHANNELS;
+
+	//one accumulator per integer in a row, as in SSE_Fixed
+	uint32_t accumulator[row_length] = {};
+	for (int row = 0; row<HEIGHT; row++)
+	{
+		const int* block_row = block + row*row_length;
+		const int* search_row = search + row*search_stride;
+		for (int i = 0; i<row_length; i++)
+		{
+			int difference = block_row[i] - search_row[i];
+			accumulator[i] = accumulator[i] + uint32_t(difference < 0 ? -difference : difference);
+		}
+	}
+
+	uint32_t SAD = 0;
+	for (int i = 0; i<row_length; i++)
+	{
+		SAD = SAD + accumulator[i];
+	}
+	return SAD;
+}
+
+//Function used to get the index of the least of a list of costs, the first among equal costs
+//Inputs: costs, number of costs (at least 1), least cost to be set
+//Output: the index of the least cost
+inline int Least_Cost(const uint32_t* costs, int count, uint32_t &least_cost)
+{
+	int least = 0;
+	for (int candidate = 1; candidate<count; candidate++)
+	{
+		if(costs[candidate] < costs[least])
+		{
+			least = candidate;
+		}
+	}
+	least_cost = costs[least];
+	return least;
+}
+
+//Batch SSD (SQUARED) or SAD kernel: the fixed kernel is inlined for every search block, such that the macroblock stays
+//in the L1 cache and the costs are compared as they are computed. Every search block still reads the whole macroblock:
+//scoring the search blocks two, three or nine at a time in one pass over the rows, sharing every row of the macroblock
+//between them, was no faster with SSE2 (and slower for 4x4 blocks), as the 32-bit products and the accumulators of a
+//group take as many instructions and registers as the loads they save.
+template <int WIDTH, int HEIGHT, int CHANNELS, bool SQUARED>
+int Batch_Cost_Fixed(const int* block, const int* const* search, int count, int search_stride, int, int, int,
+		const uint32_t* rates, uint32_t &least_cost)
+{
+	uint32_t costs[MAX_CANDIDATES] = {};
+	for (int candidate = 0; candidate<count; candidate++)
+	{
+		costs[candidate] = (SQUARED ? SSE_Fixed<WIDTH,HEIGHT,CHANNELS>(block, search[candidate], search_stride, 0, 0, 0) :
+				SAD_Fixed<WIDTH,HEIGHT,CHANNELS>(block, search[candidate], search_stride, 0, 0, 0)) + rates[candidate];
+	}
+	return Least_Cost(costs, count, least_cost);
+}
+
+template <int SIZE, int WIDTH, int HEIGHT, int CHANNELS>
+uint32_t SATD_Fixed(const int* block, const int* search, int search_stride, int, int, int)
+{
+	//The differences of the whole block are transformed at once by a Hadamard transform of every SIZExSIZE sub-block and
+	//channel: the butterflies along the columns combine whole rows, and those along the rows run over the channels of half
+	//a sub-block, such that the inner loops run over contiguous integers which the compiler can vectorize
+	const int row_length = WIDTH*CHANNELS;
+	int difference[HEIGHT][row_length];
+	for (int row = 0; row<HEIGHT; row++)
+	{
+		for (int i = 0; i<row_length; i++)
+		{
+			difference[row][i] = block[row*row_length + i] - search[row*search_stride + i];
+		}
+	}
+
+	for (int half_span = 1; half_span<SIZE; half_span = half_span*2)
+	{
+		for (int start = 0; start<HEIGHT; start = start+2*half_span)
+		{
+			for (int row = start; row<start+half_span; row++)
+			{
+				for (int i = 0; i<row_length; i++)
+				{
+					int a = difference[row][i];
+					int b = difference[row+half_span][i];
+					difference[row][i] = a + b;
+					difference[row+half_span][i] = a - b;
+				}
+			}
+		}
+	}
+
+	for (int half_span = 1; half_span<SIZE; half_span = half_span*2)
+	{
+		for (int row = 0; row<HEIGHT; row++)
+		{
+			for (int start = 0; start<WIDTH; start = start+2*half_span)
+			{
+				for (int i = start*CHANNELS; i<(start+half_span)*CHANNELS; i++)
+				{
+					int a = difference[row][i];
+					int b = difference[row][i+half_span*CHANNELS];
+					difference[row][i] = a + b;
+					difference[row][i+half_span*CHANNELS] = a - b;
+				}
+			}
+		}
+	}
+
+	//the absolute transformed differences of every sub-block (over all its channels) are summed and normalized as in video
+	//encoders: halved for 4x4, divided by 4 for 8x8
+	uint32_t SATD = 0;
+	for (int row = 0; row<HEIGHT; row = row+SIZE)
+	{
+		for (int col = 0; col<WIDTH; col = col+SIZE)
+		{
+			uint32_t sub_block = 0;
+			for (int sub_row = row; sub_row<row+SIZE; sub_row++)
+			{
+				for (int i = col*CHANNELS; i<(col+SIZE)*CHANNELS; i++)
+				{
+					sub_block = sub_block + uint32_t(difference[sub_row][i] < 0 ? -difference[sub_row][i] : difference[sub_row][i]);
+				}
+			}
+			SATD = SATD + ((SIZE == 4) ? (sub_block+1)/2 : (sub_block+2)/4);
+		}
+	}
+	return SATD;
+}
+
+template <int WIDTH, int HEIGHT, int CHANNELS>
+void Set_Block_Fixed(const int* input, int input_stride, int* block, int, int, int)
+{
+	const int row_length = WIDTH*CHANNELS;
+	for (int row = 0; row<HEIGHT; row++)
+	{
+		for (int i = 0; i<row_length; i++)
+		{
+			block[row*row_length+i] = input[row*input_stride+i];
+		}
+	}
+}
+
+#endif
@@ -1,16 +1,15 @@
 #include "jbutil.h"
+#include "Trace.h"
+#include "MotionEstimator.h"
+#include "Sequence.h"
+#include "Strip_Stream.h"
 #include <vector>
 #include <limits>
 #include <istream>
 #include <cmath>
 #include <string>
-
-//Parameters for the algorithm: macroblock width and height and search area parameters
-int block_width = 8;
-int block_height = 8;
-int search_vertical = 8;
-int search_horizontal =8;
-
+#include <sstream>
+#include <memory>
 
 bool Load_Frames(std::string path, jbutil::image<int> &frame1,jbutil::image<int> &frame2)
 	{
@@ -54,256 +53,374 @@ bool Load_Frames(std::string path, jbutil::image<int> &frame1,jbutil::image<int>
 			return true;
 	}
 
-bool Parameter_Check(jbutil::image<int> &frame_1)
+//Function used to load a single frame
+//Inputs: path of the file, frame to be set
+//Output: True if the frame was loaded, False if not
+bool Load_Frame(const std::string &file_path, jbutil::image<int> &frame)
 {
-	if(!(frame_1.get_cols()%block_width == 0))	//checks to ensure that image width and height are exact multiplies of the block width and height
-	{
-		#ifndef NDEBUG
-			  std::cerr << "Error: Block Width and Image Width are not exact multiples \n" << std::flush;
-		#endif
-		return false;
-	}
-	else if(!(frame_1.get_rows()%block_height == 0))
+	std::ifstream file(file_path.c_str());
+	if(!file)
 	{
 		#ifndef NDEBUG
-			  std::cerr << "Error: Block Height and Image Height are not exact multiples \n" << std::flush;
+			std::cerr << "Error Loading " << file_path << "\n" << std::flush;
 		#endif
 		return false;
 	}
+	frame.load(file);
 	return true;
 }
 
-//Function used to create an image from a range in a given image
-//Inputs: image from where to get range, image which is to be set (will be overwritten with the new range),
-//        image parameters: channel start and stop, column start and stop,
-//        row start and stop, top left pixel co-ordinates of where to set the range
-//Output: None
-void Set_Image_Range(jbutil::image<int> &input, jbutil::image<int> &output, int channel_start, int channel_stop, int col_start, int col_stop, int row_start, int row_stop)
+//Function used to check that two frames have the same size and number of channels
+//Inputs: frames to be compared
+//Output: True if the frames have the same size, False if not
+bool Same_Size(const jbutil::image<int> &frame1, const jbutil::image<int> &frame2)
 {
-	jbutil::image<int> new_output((row_stop-row_start), (col_stop-col_start),(channel_stop-channel_start)); //define a new image
+	return (frame1.get_rows() == frame2.get_rows()) && (frame1.get_cols() == frame2.get_cols()) && (frame1.channels() == frame2.channels());
+}
 
-	int count_channel = 0;
-	for(int channel = channel_start; channel<channel_stop; channel++)		//for the defined channels
+//Function used to read a list of comma separated positive integers
+//Inputs: text to be read, number of integers expected, integers to be set
+//Output: True if the text holds the expected number of positive integers, False if not
+bool Parse_List(const std::string &text, int count, int* values)
+{
+	std::istringstream stream(text);
+	std::string value;
+	int index = 0;
+	while(std::getline(stream, value, ','))
 	{
-		int count_row = 0;
-		for (int row = row_start; row<row_stop; row++)						//for the range of rows given
+		if((index == count) || (atoi(value.c_str()) <= 0))
 		{
-			int count_col = 0;
-			for(int col = col_start; col<col_stop; col++)					//for the range of columns given
-			{
-				new_output(count_channel,count_row,count_col) = input(channel,row,col);	//set the new image
-				count_col++;
-			}
-			count_row++;
+			return false;
 		}
-		count_channel++;
+		values[index] = atoi(value.c_str());
+		index++;
 	}
-	output = new_output;										//set the old image to the new image defined above
+	return index == count;
 }
 
-//Function used to modify a range in a given image
-//Inputs: image from where to get range, image where to set range, image parameters: channel start and stop, column start and stop,
-//        row start and stop, top left pixel co-ordinates of where to set the range
-//Output: None
-void Modify_Image_Range(jbutil::image<int> &input, jbutil::image<int> &output, int channel_start, int channel_stop, int col_start, int col_stop, int row_start, int row_stop, int output_col, int output_row)
+//Function used to read the optional arguments, given as --name=value after the positional ones
+//Inputs: argument count and values, index of the first optional argument, path of the trace file to be set,
+//        parameters of the algorithm and sequence parameters to be set (frames is left at 0 if no sequence is used),
+//        bidirectional and strip streaming modes to be set
+//Output: True if all the optional arguments are known and can be combined, False if not
+bool Parse_Options(int argc, char* argv[], int first, std::string &trace_path, Motion_Parameters &parameters, Sequence_Parameters &sequence,
+		bool &bidirectional, bool &streaming)
 {
-	for(int channel = channel_start; channel<channel_stop; channel++)	//for the defined channels
+	for (int arg = first; arg<argc; arg++)
 	{
-		int row_count = 0;												//for the defined rows
-		for (int row = row_start; row<row_stop; row++)
+		std::string option(argv[arg]);
+		if(option.compare(0, 8, "--trace=") == 0)
+		{
+			trace_path = option.substr(8);
+		}
+		else if(option.compare(0, 15, "--scene-change=") == 0)
+		{
+			parameters.scene_change_threshold = atoi(option.c_str()+15);
+		}
+		else if(option.compare(0, 8, "--order=") == 0)
+		{
+			std::string order = option.substr(8);
+			if(order == "raster")
+			{
+				parameters.traversal = TRAVERSAL_RASTER;
+			}
+			else if(order == "tiled")
+			{
+				parameters.traversal = TRAVERSAL_TILED;
+			}
+			else if(order == "z")
+			{
+				parameters.traversal = TRAVERSAL_Z_ORDER;
+			}
+			else if(order == "hilbert")
+			{
+				parameters.traversal = TRAVERSAL_HILBERT;
+			}
+			else
+			{
+				#ifndef NDEBUG
+					std::cerr << "Unknown traversal order: " << order << "\n" << std::flush;
+				#endif
+				return false;
+			}
+		}
+		else if((option.compare(0, 7, "--tile=") == 0) && (atoi(option.c_str()+7) > 0))
+		{
+			parameters.tile_size = atoi(option.c_str()+7);
+		}
+		else if(option == "--window")
+		{
+			parameters.sliding_window = true;
+		}
+		else if(option == "--predictors")
+		{
+			parameters.predictors = true;
+		}
+		else if(option == "--bidirectional")
+		{
+			bidirectional = true;
+		}
+		else if(option == "--stream")
+		{
+			streaming = true;
+		}
+		else if(option == "--obmc")
+		{
+			parameters.overlapped = true;
+		}
+		else if(option == "--incremental")
+		{
+			parameters.incremental = true;
+		}
+		else if(option.compare(0, 9, "--global=") == 0)
+		{
+			parameters.global_range = atoi(option.c_str()+9);
+		}
+		else if(option.compare(0, 11, "--adaptive=") == 0)
+		{
+			parameters.adaptive_minimum = atoi(option.c_str()+11);
+		}
+		else if((option.compare(0, 12, "--prescreen=") == 0) && (atoi(option.c_str()+12) >= 0) && (atoi(option.c_str()+12) <= 9))
 		{
-			int col_count = 0;
-			for(int col = col_start; col<col_stop; col++)				//for the defined columns
+			parameters.prescreen_candidates = atoi(option.c_str()+12);
+		}
+		else if(option.compare(0, 9, "--metric=") == 0)
+		{
+			std::string metric = option.substr(9);
+			if(metric == "ssd")
+			{
+				parameters.metric = METRIC_SSD;
+			}
+			else if(metric == "sad")
+			{
+				parameters.metric = METRIC_SAD;
+			}
+			else if(metric == "satd4")
+			{
+				parameters.metric = METRIC_SATD_4;
+			}
+			else if(metric == "satd8")
+			{
+				parameters.metric = METRIC_SATD_8;
+			}
+			else
 			{
-				output(channel,output_row+row_count,output_col+col_count) = input(channel,row,col);	//set the range in the output image
-				col_count++;
+				#ifndef NDEBUG
+					std::cerr << "Unknown metric: " << metric << "\n" << std::flush;
+				#endif
+				return false;
 			}
-			row_count++;
 		}
+		else if(option.compare(0, 9, "--lambda=") == 0)
+		{
+			parameters.rate_lambda = atoi(option.c_str()+9);
+		}
+		else if(option.compare(0, 13, "--references=") == 0)
+		{
+			parameters.reference_frames = atoi(option.c_str()+13);
+		}
+		else if(option.compare(0, 7, "--skip=") == 0)
+		{
+			parameters.skip_threshold = atoi(option.c_str()+7);
+		}
+		else if((option.compare(0, 9, "--frames=") == 0) && (atoi(option.c_str()+9) >= 2))
+		{
+			sequence.frames = atoi(option.c_str()+9);
+		}
+		else if((option.compare(0, 10, "--workers=") == 0) && Parse_List(option.substr(10), STAGE_COUNT, sequence.workers))
+		{
+		}
+		else if((option.compare(0, 8, "--depth=") == 0) && (atoi(option.c_str()+8) > 0))
+		{
+			sequence.depth = atoi(option.c_str()+8);
+		}
+		else if((option == "--schedule=pipeline") || (option == "--schedule=steal"))
+		{
+			sequence.schedule = (option == "--schedule=steal") ? SCHEDULE_WORK_STEALING : SCHEDULE_PIPELINE;
+		}
+		else if((option.compare(0, 10, "--threads=") == 0) && (atoi(option.c_str()+10) > 0))
+		{
+			sequence.threads = atoi(option.c_str()+10);
+		}
+		else if((option.compare(0, 8, "--chunk=") == 0) && (atoi(option.c_str()+8) > 0))
+		{
+			sequence.rows_per_task = atoi(option.c_str()+8);
+		}
+		else
+		{
+			#ifndef NDEBUG
+				std::cerr << "Unknown option: " << option << "\n" << std::flush;
+			#endif
+			return false;
+		}
+	}
+
+	//only a sequence has older frames to search
+	if((parameters.reference_frames > 1) && (sequence.frames == 0))
+	{
+		#ifndef NDEBUG
+			std::cerr << "Error: --references needs --frames \n" << std::flush;
+		#endif
+		return false;
 	}
+	return true;
 }
 
-//Function used to calculate the Mean Square Error between 2 blocks
-//Inputs:  the 2 blocks to compare
-//Outputs: the MSE value
-float MSE(jbutil::image<int> &Block_1,jbutil::image<int> &Block_2)
+//Function used to process a sequence of frames with the pipeline and print the result of every frame
+//Inputs: path of the frames, parameters of the algorithm and of the pipeline
+//Output: None
+void Run_Sequence(const std::string &path, const Motion_Parameters &parameters, const Sequence_Parameters &sequence)
 {
-	float MSE=0.0;	//start with an MSE of 0
-	for (int channel = 0; channel<Block_1.channels(); channel++)	//for every channel
+	std::vector<Sequence_Result> results;
+
+	double t = Trace_Seconds();
+	bool processed;
 	{
-		for (int row = 0; row<Block_1.get_rows(); row++)			//for every row
+		TRACE_SCOPE("Sequence");
+		processed = Process_Sequence(path, parameters, sequence, results);
+	}
+	t = Trace_Seconds() - t;
+
+	if(!processed)
+	{
+		#ifndef NDEBUG
+			std::cerr << "Error Processing Sequence \n" << std::flush;
+		#endif
+		return;
+	}
+
+	for (size_t result = 0; result<results.size(); result++)
+	{
+		std::cout << "Frame " << results[result].frame << ": PSNR " << results[result].PSNR << "dB, cost " << results[result].cost;
+		if(parameters.skip_threshold > 0)
 		{
-			for (int col = 0; col<Block_1.get_cols(); col++)		//and for every column
-			{
-				MSE = MSE + float(pow((Block_1(channel,row,col) - Block_2(channel,row,col)),2));	//calculate the MSE
-			}
+			std::cout << ", skipped " << results[result].skipped_blocks << " of " << results[result].blocks << " blocks";
+		}
+		if(parameters.global_range > 0)
+		{
+			std::cout << ", global motion (" << results[result].global_x << ", " << results[result].global_y << ")";
+		}
+		if(parameters.reference_frames > 1)
+		{
+			std::cout << ", " << results[result].older_reference_blocks << " blocks from older references";
 		}
+		if(parameters.incremental)
+		{
+			std::cout << ", carried " << results[result].carried_blocks << " of " << results[result].blocks << " blocks";
+		}
+		if(results[result].scene_change)
+		{
+			std::cout << ", scene change";
+		}
+		std::cout << std::endl;
 	}
-	MSE = MSE / float(Block_1.channels()*Block_1.get_rows()*Block_1.get_cols());		//normalize the MSE
-	return MSE;
+	std::cout << "Total Time taken: " << t << "s (" << t/results.size() << "s per frame)" << std::endl;
 }
 
-//Function used to set a start co-ordinate of a search area for a macroblock
-//Inputs:  centre_coordinate for the Macroblock whose search area will be set
-//		   the distance to be moved to set the output co-ordinate
-//Outputs: the start co-ordinate
-int Get_Search_Area_Start(int search_dist, int centre_coordinate)
+//Function used to compare the search with pre-screening against the same search scoring every search block on all its
+//pixels, printing the time taken by each search and the sum of the costs of the macroblocks
+//Inputs: frames, parameters of the algorithm (with pre-screening), scheduler (NULL if none), macroblock rows per chunk
+//Output: None
+void Report_Prescreening(const jbutil::image<int> &frame1, const jbutil::image<int> &frame2, const Motion_Parameters &parameters,
+		Work_Stealing_Scheduler* scheduler, int rows_per_task)
 {
-	int start = centre_coordinate - search_dist;	//set the top left column/row co-ordinate
-	if (start < 0)						//check that it is not out of bounds
+	Motion_Parameters full_parameters = parameters;
+	full_parameters.prescreen_candidates = 0;
+	const Motion_Parameters* searches[2] = {&parameters, &full_parameters};
+	const char* names[2] = {"Pre-screened Search", "Full Search"};
+
+	uint64_t costs[2];
+	for (int search = 0; search<2; search++)
 	{
-		return 0;						//if it is, set it to a default value
+		MotionEstimator estimator(*searches[search]);
+		estimator.set_scheduler(scheduler, rows_per_task);
+		MotionField field;
+
+		double t = Trace_Seconds();
+		estimator.estimate(frame1, frame2, field);
+		t = Trace_Seconds() - t;
+
+		costs[search] = 0;
+		for (int block = 0; block<field.get_blocks_x()*field.get_blocks_y(); block++)
+		{
+			costs[search] = costs[search] + field.cost_plane()[block];
+		}
+		std::cout << names[search] << ": " << t << "s, cost " << costs[search] << std::endl;
 	}
-	return start;
+	std::cout << "Pre-screening Cost Increase: " << 100.0*(double(costs[0])-double(costs[1]))/double(costs[1]) << "%" << std::endl;
 }
 
-//Function used to set a stop co-ordinate of a search area for a macroblock
-//Inputs:  centre_coordinate for the Macroblock whose search area will be set
-//		   the distance to be moved to set the output co-ordinate
-//		   the maximum row/column value to be used to check for out of bounds
-//Outputs: the stop co-ordinate
-int Get_Search_Area_Stop(int max,  int search_dist,  int centre_coordinate, int block_distance)
+//Function used to predict frame 2 from frame 1 with strip streaming, saving the reconstructed frame as
+//Reconstructed_Frame.ppm as it is set. The time, the PSNR and the frame data held at once are printed
+//Inputs: path of the frames, parameters of the algorithm
+//Output: None
+void Run_Streaming(const std::string &path, const Motion_Parameters &parameters)
 {
-	int stop = centre_coordinate + block_distance + search_dist;  //set the final pixel's column co-ordinate
-	if(stop > max)					//check that it is not out of bounds
+	Strip_Result result;
+	double t = Trace_Seconds();
+	bool processed;
+	{
+		TRACE_SCOPE("Strip Stream");
+		processed = Process_Strips(path, parameters, result);
+	}
+	t = Trace_Seconds() - t;
+	if(!processed)
 	{
-		return max;					//if it is, set it to a default value
+		return;
 	}
-	return stop;
+	std::cout << "Time for Streamed Block Match and Reconstruction: " << t << "s" << std::endl;
+	std::cout << "PSNR: " << result.PSNR << "dB, cost " << result.cost << ", " << result.skipped_blocks << " of " << result.blocks
+			<< " blocks skipped" << std::endl;
+	std::cout << "Frame Data Held: " << double(result.resident_bytes)/(1024.0*1024.0) << "MB (whole frames: "
+			<< 3.0*double(result.frame_bytes)/(1024.0*1024.0) << "MB)" << std::endl;
 }
 
-//Function to perform the block matching algorithm
-//Inputs: Reference Frame, Frame to be Predicted, Reference Frame object to be modified
-//Output: True is successful, False if not
-void Block_Match(jbutil::image<int> &frame_1,jbutil::image<int> &frame_2,jbutil::image<int> &reconstructed_frame2)
+//Function used to predict frame 2 from both frame 1 and frame 3, saving the bi-predicted frame as Reconstructed_Frame.ppm.
+//The time of the bidirectional search and the PSNR of the forward, backward and bi-predicted frames are printed
+//Inputs: path of the frames, frames, parameters of the algorithm, scheduler (NULL if none), macroblock rows per chunk
+//Output: None
+void Run_Bidirectional(const std::string &path, const jbutil::image<int> &frame1, const jbutil::image<int> &frame2, const jbutil::image<int> &frame3,
+		const Motion_Parameters &parameters, Work_Stealing_Scheduler* scheduler, int rows_per_task)
 {
-	//For each macroblock
-	for (int macroblock_x = 0; macroblock_x<frame_2.get_cols(); macroblock_x = macroblock_x+block_width)
-		{
-			for (int macroblock_y = 0; macroblock_y<frame_2.get_rows(); macroblock_y = macroblock_y+block_height)
-			{
-				//set the search are start and stop co-ordinates
-				int search_area_x_start 	= Get_Search_Area_Start(search_horizontal, macroblock_x);
-				int search_area_x_stop 		= Get_Search_Area_Stop(frame_1.get_cols(), search_horizontal, macroblock_x, block_width);
-				int search_area_y_start 	= Get_Search_Area_Start(search_vertical, macroblock_y);
-				int search_area_y_stop 		= Get_Search_Area_Stop(frame_1.get_rows(), search_vertical, macroblock_y, block_height);
-
-
-				//Set the pixel values for the macroblock
-				jbutil::image<int> macroblock;
-				Set_Image_Range(frame_2, macroblock, 0, frame_2.channels(), macroblock_x, macroblock_x+block_width, macroblock_y, macroblock_y+block_height);
-
-
-				jbutil::image<int> search_block;						//The search block specific for each macroblock
-				float least_MSE = std::numeric_limits<float>::max();	//The lowest MSE found for the macroblock
-				int least_MSE_x = macroblock_x;		//The top left column coordinate of the search block with the lowest MSE
-				int least_MSE_y = macroblock_y;		//The top left row coordinate of the search block with the lowest MSE
-				int new_least_MSE_x = 0;								//These 2 values are temporary values which are updated if a lower MSE search block is
-				int new_least_MSE_y = 0;								//found. These are needed since, for a single iteration least_MSE_x and y are constant
-
-
-				int search_dist_x = search_horizontal/2;				//search dist parameters used in the three step search algorithm
-				int search_dist_y = search_vertical/2;
-
-
-				for (int search_count = 0; search_count<3;search_count++)	//for loop to denote the step in which the 3 step search has reached
-				{
-					//these 2 for loops are used to define the 9 search blocks for every step in the 3 step search. Note that x and y are used
-					//not only as counters but also help to set the search block co-ordinates
-					for (int x = -search_dist_x; x<=search_dist_x; x=x+search_dist_x)
-					{
-						for (int y = -search_dist_y; y<=search_dist_y; y=y+search_dist_y)
-						{
-
-							//set the search block start and stop co-ordinates
-							int block_x_start = least_MSE_x + x;
-							int block_x_stop = block_x_start + block_width;
-							int block_y_start = least_MSE_y + y;
-							int block_y_stop = block_y_start + block_height;
-
-
-							//if out of bounds, skip this iteration
-							if((block_x_start < 0)||	(block_x_stop > search_area_x_stop) ||	(block_y_start < 0) || 	(block_y_stop > search_area_y_stop))	//check to ensure top left pixel's column coordinate is not less than 0
-							{
-								continue;
-							}
-
-							//Set the pixel values for the search block
-							Set_Image_Range(frame_1, search_block, 0, frame_1.channels(),block_x_start, block_x_stop, block_y_start, block_y_stop);
-
-
-							//Calculate the mse value between the search block and macroblock
-						    float current_MSE = MSE(macroblock,search_block);
-
-
-							//If a search block with a lower MSE is found, update the parameters
-							if(current_MSE<least_MSE)
-							{
-								least_MSE = current_MSE;
-								//Here, cannot use least_MSE_x and least_MSE_y, since these are needed as constants in
-								//a single step loop (used when setting co-ordinates for search block)
-								new_least_MSE_x = block_x_start;
-								new_least_MSE_y = block_y_start;
-
-							}
-						}
-					}
-
-					//Once a step is finished, update these values to represent the block with the lowest MSE
-					least_MSE_x = new_least_MSE_x;
-					least_MSE_y = new_least_MSE_y;
-
-					//Update also the search dist parameters to get finer searches.
-					//After 3 iterations, they should be set to 1 such that macroblocks differ by 1 pixel
-					if(search_count == 1)
-					{
-						search_dist_x = 1;
-						search_dist_y = 1;
-					}
-					else if(search_count != 2)
-					{
-						//using fast ceil - must be done since no guarantee division will result in exact multiples
-						search_dist_x = int((search_dist_x+(search_dist_x/2)-1)/((search_dist_x/2)));
-						search_dist_y = int((search_dist_y+(search_dist_y/2)-1)/((search_dist_y/2)));
-					}
-
-
-					//Redefine the new search area, such that it is smaller and centered around the block with the smallest MSE
-					//Note that this cannot be done if the count is equal to 2, since this means that there are no more iterations
-					if(search_count != 2)
-					{
-						int search_area_x_start 	= Get_Search_Area_Start(search_dist_x, least_MSE_x);
-						int search_area_x_stop 		= Get_Search_Area_Stop(frame_1.get_cols(), search_dist_x, least_MSE_x, block_width);
-						int search_area_y_start 	= Get_Search_Area_Start(search_dist_y, least_MSE_y);
-						int search_area_y_stop 		= Get_Search_Area_Stop(frame_1.get_rows(), search_dist_y, least_MSE_y, block_height);
-					}
-				}
-
-				//By the final iteration, the least MSE block has been defined as the best MSE macroblock from those searched.
-				//therefore the motion vector can be calculated from the top left pixel location of the least mse block and the top left pixel
-				//location of the macroblock
-				int motion_vector_x = least_MSE_x - macroblock_x;
-
-				int motion_vector_y = least_MSE_y - macroblock_y;
-
-				//set the area from the reference frame in the reconstructed frame
-				int x_start = macroblock_x+motion_vector_x;
-				int x_stop = x_start + block_width;
-
-				int y_start = macroblock_y+motion_vector_y;
-				int y_stop = y_start + block_height;
-
-				Modify_Image_Range(frame_1, reconstructed_frame2, 0, reconstructed_frame2.channels(), x_start, x_stop, y_start,y_stop, macroblock_x, macroblock_y);
+	MotionEstimator estimator(parameters);
+	estimator.set_scheduler(scheduler, rows_per_task);
+	MotionField forward_field;
+	MotionField backward_field;
+	jbutil::image<int> reconstructed_frame2(frame2.get_rows(), frame2.get_cols(), frame2.channels());
 
-			}
+	double t = Trace_Seconds();
+	{
+		TRACE_SCOPE("Bidirectional Block Match");
+		estimator.estimate(frame1, frame2, frame3, forward_field, backward_field);
+	}
+	t = Trace_Seconds() - t;
+	std::cout << "Bidirectional Search: " << t << "s" << std::endl;
+	estimator.reconstruct(frame1, frame3, forward_field, backward_field, reconstructed_frame2);
+
+	Linear_Frame previous, current, next, reconstructed;
+	Linearize_Image(frame1, previous);
+	Linearize_Image(frame2, current);
+	Linearize_Image(frame3, next);
+	reconstructed.resize(current.rows, current.cols, current.channels);
+	Reconstruct_Frame(previous, forward_field, parameters.block_width, parameters.block_height, reconstructed);
+	std::cout << "PSNR: forward " << PSNR(current, reconstructed);
+	Reconstruct_Frame(next, backward_field, parameters.block_width, parameters.block_height, reconstructed);
+	std::cout << "dB, backward " << PSNR(current, reconstructed);
+	Linearize_Image(reconstructed_frame2, reconstructed);
+	std::cout << "dB, bi-predicted " << PSNR(current, reconstructed) << "dB" << std::endl;
 
-		}
+	{
+		TRACE_SCOPE("Save");
+		std::ofstream output;
+		output.open((path+std::string("/Reconstructed_Frame.ppm")).c_str());
+		reconstructed_frame2.save(output);
+	}
 }
 
 //Main Function
 int main(int argc, char* argv[])
 {
-	if(argc!=6)
+	if(argc<6)
 	{
 		#ifndef NDEBUG
 			  std::cerr << "Not enough input arguments\n" << std::flush;
@@ -311,13 +428,14 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 
-	block_width 		= atoi(argv[1]);
-	block_height 		= atoi(argv[2]);
-	search_vertical 	= atoi(argv[3]);
-	search_horizontal 	= atoi(argv[4]);
+	Motion_Parameters parameters;
+	parameters.block_width 			= atoi(argv[1]);
+	parameters.block_height 		= atoi(argv[2]);
+	parameters.search_vertical 		= atoi(argv[3]);
+	parameters.search_horizontal 	= atoi(argv[4]);
 	std::string path(argv[5]);
 
-	if((block_width == 0) || (block_height == 0) || (search_vertical == 0) || (search_horizontal == 0))
+	if((parameters.block_width == 0) || (parameters.block_height == 0) || (parameters.search_vertical == 0) || (parameters.search_horizontal == 0))
 	{
 		#ifndef NDEBUG
 			std::cerr<<"Integer parameters must be non-zero \n"<<std::flush;
@@ -325,35 +443,143 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 
+	//Optional arguments
+	std::string trace_path;
+	Sequence_Parameters sequence;
+	sequence.frames = 0;
+	bool bidirectional = false;
+	bool streaming = false;
+	if(!Parse_Options(argc, argv, 6, trace_path, parameters, sequence, bidirectional, streaming))
+	{
+		return 0;
+	}
+
+	if(!trace_path.empty())
+	{
+		Trace_Recorder::Instance().Enable();
+	}
+
+	//the steps of a range which is a power of two add up to one pixel less than the range
+	#ifndef NDEBUG
+	{
+		int reach_x, reach_y;
+		MotionEstimator(parameters).get_search_reach(reach_x, reach_y);
+		if((reach_y < parameters.search_vertical) || (reach_x < parameters.search_horizontal))
+		{
+			std::cerr << "Search Reach: " << reach_y << " x " << reach_x << " pixels \n" << std::flush;
+		}
+	}
+	#endif
+
+	//a sequence of frames goes through the pipeline, and every reconstructed frame is saved as Reconstructed_FrameK.ppm
+	if(sequence.frames != 0)
+	{
+		Run_Sequence(path, parameters, sequence);
+		if(!trace_path.empty())
+		{
+			Trace_Recorder::Instance().Save(trace_path);
+		}
+		return 0;
+	}
+
+	//strip streaming: the frames are read, predicted and written a macroblock row at a time, and are never held whole
+	if(streaming)
+	{
+		Run_Streaming(path, parameters);
+		if(!trace_path.empty())
+		{
+			Trace_Recorder::Instance().Save(trace_path);
+		}
+		return 0;
+	}
+
 
 	//Objects to hold the 2 frames
 	jbutil::image<int> frame1;
 	jbutil::image<int> frame2;
 
 	//Load the frames
-	if(!Load_Frames(path, frame1, frame2))
 	{
-		return 0;
+		TRACE_SCOPE("Load");
+		if(!Load_Frames(path, frame1, frame2))
+		{
+			return 0;
+		}
 	}
 
 	//Check the parameters
-	if(!Parameter_Check(frame1))
+	MotionEstimator estimator(parameters);
+	if(!estimator.check(frame1))
 	{
 		return 0;
 	}
 
-	//Object to hold the reconstructed frame 2
+	//with --threads, the macroblock rows are split into chunks run by a work stealing scheduler
+	std::unique_ptr<Work_Stealing_Scheduler> scheduler;
+	if(sequence.threads != 0)
+	{
+		scheduler.reset(new Work_Stealing_Scheduler(sequence.threads));
+		estimator.set_scheduler(scheduler.get(), sequence.rows_per_task);
+	}
+
+	//bidirectional mode: frame 2 is predicted from frame 1 and frame3.ppm, which must all have the same size
+	if(bidirectional)
+	{
+		jbutil::image<int> frame3;
+		if(!Load_Frame(path+std::string("/frame3.ppm"), frame3))
+		{
+			return 0;
+		}
+		if(!estimator.check(frame2) || !estimator.check(frame3) || !Same_Size(frame1, frame2) || !Same_Size(frame3, frame2))
+		{
+			#ifndef NDEBUG
+				std::cerr << "Error: The three frames must have the same size \n" << std::flush;
+			#endif
+			return 0;
+		}
+		Run_Bidirectional(path, frame1, frame2, frame3, parameters, scheduler.get(), sequence.rows_per_task);
+		if(!trace_path.empty())
+		{
+			Trace_Recorder::Instance().Save(trace_path);
+		}
+		return 0;
+	}
+
+	//Objects to hold the motion vectors and the reconstructed frame 2
+	MotionField motion_field;
 	jbutil::image<int> reconstructed_frame2(frame2.get_rows(),frame2.get_cols(),frame2.channels());
 
 	#ifndef NDEBUG
 		  std::cerr << "Entering Block Match Function\n" << std::flush;
 	#endif
 
-	double t = jbutil::gettime();
-	Block_Match(frame1, frame2, reconstructed_frame2);
-	t = jbutil::gettime() - t;
+	double t = Trace_Seconds();
+	{
+		TRACE_SCOPE("Block Match");
+		estimator.estimate(frame1, frame2, motion_field);
+		estimator.reconstruct(frame1, motion_field, reconstructed_frame2);
+	}
+	t = Trace_Seconds() - t;
 
 	std::cout << "Total Time taken: " << t << "s" << std::endl;
+	if(parameters.skip_threshold > 0)
+	{
+		const Motion_Statistics &statistics = estimator.get_statistics();
+		std::cout << "Skipped Blocks: " << statistics.skipped_blocks << " of " << statistics.blocks
+				<< " (" << 100.0*statistics.skipped_blocks/statistics.blocks << "%)" << std::endl;
+	}
+	if(parameters.global_range > 0)
+	{
+		std::cout << "Global Motion: (" << estimator.get_statistics().global_x << ", " << estimator.get_statistics().global_y << ")" << std::endl;
+	}
+	if(estimator.get_statistics().scene_change)
+	{
+		std::cout << "Scene Change: the histograms differ by " << estimator.get_statistics().histogram_difference << "%, the frames were not searched" << std::endl;
+	}
+	if(parameters.prescreen_candidates > 0)
+	{
+		Report_Prescreening(frame1, frame2, parameters, scheduler.get(), sequence.rows_per_task);
+	}
 	#ifndef NDEBUG
 		  std::cerr << "Exiting Block Match Function\n" << std::flush;
 	#endif
@@ -361,9 +587,19 @@ int main(int argc, char* argv[])
 	#ifndef NDEBUG
 		  std::cerr << "Saving Reconstructed Frame\n" << std::flush;
 	#endif
-	std::ofstream output;
-	output.open((path+std::string("/Reconstructed_Frame.ppm")).c_str());
-	reconstructed_frame2.save(output);
+	{
+		TRACE_SCOPE("Save");
+		std::ofstream output;
+		output.open((path+std::string("/Reconstructed_Frame.ppm")).c_str());
+		reconstructed_frame2.save(output);
+	}
+
+	if(!trace_path.empty() && !Trace_Recorder::Instance().Save(trace_path))
+	{
+		#ifndef NDEBUG
+			std::cerr << "Error Saving Trace \n" << std::flush;
+		#endif
+	}
 
 	return 0;
 }
@@ -0,0 +1,1425 @@
+#include "MotionEstimator.h"
+#include "Trace.h"
+#include "Reference_Window.h"
+#include "Traversal.h"
+#include "Search_Steps.h"
+#include <limits>
+#include <atomic>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+//cache size used to choose the tile size of the tiled order: a typical L2 cache
+static const int TILE_CACHE_SIZE = 256*1024;
+
+//Function used to set a stop co-ordinate of a search area for a macroblock
+//Inputs:  centre_coordinate for the Macroblock whose search area will be set
+//		   the distance to be moved to set the output co-ordinate
+//		   the maximum row/column value to be used to check for out of bounds
+//Outputs: the stop co-ordinate
+static int Get_Search_Area_Stop(int max,  int search_dist,  int centre_coordinate, int block_distance)
+{
+	int stop = centre_coordinate + block_distance + search_dist;  //set the final pixel's column co-ordinate
+	if(stop > max)					//check that it is not out of bounds
+	{
+		return max;					//if it is, set it to a default value
+	}
+	return stop;
+}
+
+//Function used to get the co-ordinate of the centre block of a macroblock, from which its search can start: the
+//macroblock moved by the global motion vector, kept within the frame
+//Inputs: macroblock co-ordinate, global motion vector component, macroblock size and frame size along the same axis
+//Output: the co-ordinate of the centre block
+static int Get_Search_Centre(int coordinate, int global, int block_distance, int max)
+{
+	return std::min(std::max(coordinate+global, 0), max-block_distance);
+}
+
+//Function used to find the shift which best aligns two profiles, as the least mean absolute difference over the
+//samples the shifted profiles have in common
+//Inputs: profiles of the current and the reference frame, largest shift to be tested
+//Output: the shift, such that current[i] matches reference[i+shift]
+static int Profile_Shift(const std::vector<int64_t> &current, const std::vector<int64_t> &reference, int range)
+{
+	const int length = int(current.size());
+	int best_shift = 0;
+	double least_difference = std::numeric_limits<double>::max();
+	for (int shift = -range; shift<=range; shift++)
+	{
+		int start = std::max(0, -shift);
+		int stop = std::min(length, length-shift);
+		if(stop-start < length/2)
+		{
+			//too little overlap for the difference to be meaningful
+			continue;
+		}
+		int64_t difference = 0;
+		for (int i = start; i<stop; i++)
+		{
+			difference = difference + std::abs(current[i] - reference[i+shift]);
+		}
+		double mean = double(difference)/double(stop-start);
+		//ties are broken towards the smaller shift
+		if((mean < least_difference) || ((mean == least_difference) && (std::abs(shift) < std::abs(best_shift))))
+		{
+			least_difference = mean;
+			best_shift = shift;
+		}
+	}
+	return best_shift;
+}
+
+//Function used to get the projection profiles of a frame: the sums of the samples of every column and of every row
+//Inputs: frame, data of the frame to be set
+//Output: None
+static void Get_Profiles(const Linear_Frame &frame, Derived_Frame &data)
+{
+	data.column_profile.assign(frame.cols, 0);
+	data.row_profile.assign(frame.rows, 0);
+	for (int row = 0; row<frame.rows; row++)
+	{
+		const int* pixel = frame.pixel(row, 0);
+		for (int col = 0; col<frame.cols; col++)
+		{
+			int sum = 0;
+			for (int channel = 0; channel<frame.channels; channel++)
+			{
+				sum = sum + pixel[channel];
+			}
+			data.column_profile[col] = data.column_profile[col] + sum;
+			data.row_profile[row] = data.row_profile[row] + sum;
+			pixel = pixel + frame.channels;
+		}
+	}
+}
+
+//Function used to estimate the global translation between two frames from their projection profiles. A pan shifts the
+//profiles of the current frame against those of the reference frame, so the shift of each profile is found independently.
+//Inputs: Reference Frame and its profiles, Frame to be Predicted and its profiles, largest translation to be tested,
+//        global motion vector to be set
+//Output: None
+static void Global_Motion(const Linear_Frame &reference, const Derived_Frame &reference_data, const Linear_Frame &current,
+		const Derived_Frame &current_data, int range, int &global_x, int &global_y)
+{
+	global_x = Profile_Shift(current_data.column_profile, reference_data.column_profile, std::min(range, current.cols/2));
+	global_y = Profile_Shift(current_data.row_profile, reference_data.row_profile, std::min(range, current.rows/2));
+
+	//the profiles are also shifted by large moving objects, so the translation is only kept if it aligns the frames
+	//better than no translation, compared over every 4th sample along the rows and the columns
+	if((global_x != 0) || (global_y != 0))
+	{
+		const int step = 4;
+		int64_t global_difference = 0;
+		int64_t zero_difference = 0;
+		for (int row = std::max(0, -global_y); row<std::min(current.rows, current.rows-global_y); row = row+step)
+		{
+			for (int col = std::max(0, -global_x); col<std::min(current.cols, current.cols-global_x); col = col+step)
+			{
+				const int* current_pixel = current.pixel(row, col);
+				const int* global_pixel = reference.pixel(row+global_y, col+global_x);
+				const int* zero_pixel = reference.pixel(row, col);
+				for (int channel = 0; channel<current.channels; channel++)
+				{
+					global_difference = global_difference + std::abs(current_pixel[channel] - global_pixel[channel]);
+					zero_difference = zero_difference + std::abs(current_pixel[channel] - zero_pixel[channel]);
+				}
+			}
+		}
+		if(global_difference >= zero_difference)
+		{
+			global_x = 0;
+			global_y = 0;
+		}
+	}
+}
+
+//Function used to estimate the global translation between two frames from their projection profiles, computed from a
+//single pass over each frame
+//Inputs: Reference Frame, Frame to be Predicted, largest translation to be tested, global motion vector to be set
+//Output: None
+static void Global_Motion(const Linear_Frame &reference, const Linear_Frame &current, int range, int &global_x, int &global_y)
+{
+	Derived_Frame reference_data, current_data;
+	Get_Profiles(reference, reference_data);
+	Get_Profiles(current, current_data);
+	Global_Motion(reference, reference_data, current, current_data, range, global_x, global_y);
+}
+
+//Function used to get the histogram of a frame, built from every 4th sample along the rows and the columns with 64 bins
+//per channel, such that it costs about 1/16 of a pass over the frame
+//Inputs: frame, data of the frame to be set
+//Output: None
+static void Get_Histogram(const Linear_Frame &frame, Derived_Frame &data)
+{
+	const int step = 4;
+	const int bins = 64;
+	data.histogram.assign(bins*frame.channels, 0);
+	data.histogram_samples = 0;
+	for (int row = 0; row<frame.rows; row = row+step)
+	{
+		for (int col = 0; col<frame.cols; col = col+step)
+		{
+			const int* pixel = frame.pixel(row, col);
+			for (int channel = 0; channel<frame.channels; channel++)
+			{
+				data.histogram[channel*bins + (pixel[channel]>>2)]++;
+				data.histogram_samples++;
+			}
+		}
+	}
+}
+
+//Function used to compare the histograms of two frames (of the same size)
+//Inputs: data of the two frames
+//Output: percentage of the sampled samples which fall in different bins (0 for the same histograms, 100 for disjoint ones)
+static int Histogram_Difference(const Derived_Frame &data_1, const Derived_Frame &data_2)
+{
+	//every sample which moved to another bin is counted once in each histogram
+	int difference = 0;
+	for (size_t bin = 0; bin<data_1.histogram.size(); bin++)
+	{
+		difference = difference + std::abs(data_1.histogram[bin] - data_2.histogram[bin]);
+	}
+	return (data_1.histogram_samples == 0) ? 0 : (50*difference)/data_1.histogram_samples;
+}
+
+//Function used to compare the histograms of two frames
+//Inputs: the two frames (of the same size)
+//Output: percentage of the sampled samples which fall in different bins
+static int Histogram_Difference(const Linear_Frame &frame_1, const Linear_Frame &frame_2)
+{
+	Derived_Frame data_1, data_2;
+	Get_Histogram(frame_1, data_1);
+	Get_Histogram(frame_2, data_2);
+	return Histogram_Difference(data_1, data_2);
+}
+
+MotionEstimator::MotionEstimator(const Motion_Parameters& parameters) :
+	parameters(parameters), scheduler(NULL), rows_per_task(4), kernels(NULL), cost(NULL), batch_cost(NULL), decimated_cost(NULL), newest_frame(0), frame_count(0), dirty_blocks(NULL)
+{
+}
+
+void MotionEstimator::set_scheduler(Work_Stealing_Scheduler* scheduler, int rows_per_task)
+{
+	this->scheduler = scheduler;
+	this->rows_per_task = (rows_per_task > 0) ? rows_per_task : 1;
+}
+
+//Function used to check the parameters against a frame
+//Inputs: frame used to check parameters
+//Output: True if all parameters are correct, False if not
+bool MotionEstimator::check(const jbutil::image<int> &frame) const
+{
+	return check(frame.get_rows(), frame.get_cols(), frame.range());
+}
+
+bool MotionEstimator::check(int rows, int cols, int range) const
+{
+	//the costs are sums of squared errors held in 32 bits, which is exact for samples of up to 8 bits
+	if(range > 255)
+	{
+		#ifndef NDEBUG
+			  std::cerr << "Error: Only images with up to 8 bits per sample are supported \n" << std::flush;
+		#endif
+		return false;
+	}
+
+	//the skip threshold is a mean cost per 8-bit sample, at most a mean square error
+	if((parameters.skip_threshold < 0) || (parameters.skip_threshold > 255*255))
+	{
+		#ifndef NDEBUG
+			  std::cerr << "Error: The skip threshold must be between 0 and 65025 \n" << std::flush;
+		#endif
+		return false;
+	}
+
+	if((parameters.scene_change_threshold < 0) || (parameters.scene_change_threshold > 100))
+	{
+		#ifndef NDEBUG
+			  std::cerr << "Error: The scene change threshold must be a percentage \n" << std::flush;
+		#endif
+		return false;
+	}
+
+	//the decimated blocks of the pre-screening have half the rows of the macroblocks
+	if((parameters.prescreen_candidates > 0) && (parameters.block_height%2 != 0))
+	{
+		#ifndef NDEBUG
+			  std::cerr << "Error: Pre-screening needs an even block height \n" << std::flush;
+		#endif
+		return false;
+	}
+
+	//the Hadamard transforms cover the macroblocks with sub-blocks of 4x4 or 8x8 pixels
+	const int transform_size = (parameters.metric == METRIC_SATD_4) ? 4 : ((parameters.metric == METRIC_SATD_8) ? 8 : 1);
+	if((parameters.block_width%transform_size != 0) || (parameters.block_height%transform_size != 0))
+	{
+		#ifndef NDEBUG
+			  std::cerr << "Error: The block width and height must be multiples of the SATD transform size \n" << std::flush;
+		#endif
+		return false;
+	}
+
+	//the rate term is added to costs of at most 32 bits
+	if((parameters.rate_lambda < 0) || (parameters.rate_lambda > 65535))
+	{
+		#ifndef NDEBUG
+			  std::cerr << "Error: The rate lambda must be between 0 and 65535 \n" << std::flush;
+		#endif
+		return false;
+	}
+
+	if((parameters.reference_frames < 1) || (parameters.reference_frames > MAX_REFERENCE_FRAMES))
+	{
+		#ifndef NDEBUG
+			  std::cerr << "Error: The number of reference frames must be between 1 and " << MAX_REFERENCE_FRAMES << " \n" << std::flush;
+		#endif
+		return false;
+	}
+
+	if((parameters.search_vertical < 1) || (parameters.search_horizontal < 1) || (parameters.adaptive_minimum < 0))
+	{
+		#ifndef NDEBUG
+			  std::cerr << "Error: The search ranges must be at least 1 \n" << std::flush;
+		#endif
+		return false;
+	}
+
+	if(!(cols%parameters.block_width == 0))	//checks to ensure that image width and height are exact multiplies of the block width and height
+	{
+		#ifndef NDEBUG
+			  std::cerr << "Error: Block Width and Image Width are not exact multiples \n" << std::flush;
+		#endif
+		return false;
+	}
+	else if(!(rows%parameters.block_height == 0))
+	{
+		#ifndef NDEBUG
+			  std::cerr << "Error: Block Height and Image Height are not exact multiples \n" << std::flush;
+		#endif
+		return false;
+	}
+	return true;
+}
+
+void MotionEstimator::estimate(const jbutil::image<int> &reference, const jbutil::image<int> &current, MotionField &field)
+{
+	{
+		TRACE_SCOPE("Linearize");
+		Linearize_Image(reference, reference_frame);
+		Linearize_Image(current, current_frame);
+	}
+	estimate(reference_frame, current_frame, field);
+}
+
+//Function used to select the kernels and size the packed macroblock for the frames being matched
+//Inputs: number of channels of the frames
+//Output: None
+void MotionEstimator::Select_Kernels(int channels)
+{
+	kernels = &Get_Block_Kernels(parameters.block_width, parameters.block_height, channels);
+	cost = Get_Cost_Kernel(parameters.block_width, parameters.block_height, channels, parameters.metric);
+	batch_cost = Get_Batch_Cost_Kernel(parameters.block_width, parameters.block_height, channels, parameters.metric);
+	decimated_cost = Get_Decimated_Cost_Kernel(parameters.block_width, parameters.block_height, channels, parameters.metric);
+	macroblock.resize(Get_Macroblock_Size(channels));
+}
+
+void MotionEstimator::estimate(const Linear_Frame &reference, const Linear_Frame &current, MotionField &field, const MotionField* temporal_field)
+{
+	field.resize(current.cols/parameters.block_width, current.rows/parameters.block_height, true);
+	Select_Kernels(current.channels);
+
+	const int blocks_y = field.get_blocks_y();
+	const int previous_global_x = statistics.global_x;
+	const int previous_global_y = statistics.global_y;
+	statistics = Motion_Statistics();
+	statistics.blocks = field.get_blocks_x()*blocks_y;
+
+	//on a scene change no motion vector is useful, so the search is not run
+	if(parameters.scene_change_threshold > 0)
+	{
+		TRACE_SCOPE("Scene Change Detection");
+		statistics.histogram_difference = Histogram_Difference(reference, current);
+		statistics.scene_change = (statistics.histogram_difference >= parameters.scene_change_threshold);
+	}
+
+	//global motion: the searches can start from the translation of the whole frame
+	if((parameters.global_range > 0) && !statistics.scene_change)
+	{
+		TRACE_SCOPE("Global Motion");
+		Global_Motion(reference, current, parameters.global_range, statistics.global_x, statistics.global_y);
+	}
+
+	//incremental mode: only the macroblocks whose search could give a different result from the previous pair are searched
+	dirty_blocks = NULL;
+	if(parameters.incremental)
+	{
+		TRACE_SCOPE("Dirty Blocks");
+		Hash_Blocks(current, current_hashes, previous_current_hashes);
+		Hash_Blocks(reference, reference_hashes, previous_reference_hashes);
+		if(statistics.scene_change)
+		{
+			//the field of a scene change is not searched, so the next pair cannot carry vectors from it
+			current_hashes.clear();
+			reference_hashes.clear();
+		}
+		else if((statistics.global_x == previous_global_x) && (statistics.global_y == previous_global_y) && Mark_Dirty_Blocks(reference, field))
+		{
+			dirty_blocks = &dirty[0];
+		}
+	}
+
+	if(statistics.scene_change)
+	{
+		Zero_Motion(reference, current, field);
+	}
+	else
+	{
+		Search_Reference search = {&reference, &field, &previous_field, statistics.global_x, statistics.global_y,
+				(temporal_field != NULL) ? temporal_field : &previous_field};
+		statistics.skipped_blocks = Search_Frame(&search, 1, current);
+	}
+
+	//the zero vectors of a scene change say nothing about the motion of the next pair
+	if(statistics.scene_change)
+	{
+		previous_field.resize(0, 0);
+	}
+	else
+	{
+		previous_field = field;
+	}
+	if(dirty_blocks != NULL)
+	{
+		statistics.carried_blocks = statistics.blocks - statistics.dirty_blocks;
+	}
+}
+
+void MotionEstimator::estimate(const jbutil::image<int> &previous, const jbutil::image<int> &current, const jbutil::image<int> &next,
+		MotionField &forward_field, MotionField &backward_field)
+{
+	{
+		TRACE_SCOPE("Linearize");
+		Linearize_Image(previous, reference_frame);
+		Linearize_Image(current, current_frame);
+		Linearize_Image(next, next_frame);
+	}
+	estimate(reference_frame, current_frame, next_frame, forward_field, backward_field);
+}
+
+void MotionEstimator::estimate(const Linear_Frame &previous, const Linear_Frame &current, const Linear_Frame &next,
+		MotionField &forward_field, MotionField &backward_field)
+{
+	forward_field.resize(current.cols/parameters.block_width, current.rows/parameters.block_height, true);
+	backward_field.resize(current.cols/parameters.block_width, current.rows/parameters.block_height, true);
+	Select_Kernels(current.channels);
+
+	statistics = Motion_Statistics();
+	statistics.blocks = forward_field.get_blocks_x()*forward_field.get_blocks_y();
+
+	//the hashes of the incremental mode are not kept up to date, so the next pair must not compare with them
+	current_hashes.clear();
+	reference_hashes.clear();
+	dirty_blocks = NULL;
+
+	//every direction has its own scene change test and global motion; only the directions which are not a scene
+	//change are searched, in one pass over the macroblocks
+	const Linear_Frame* frames[2] = {&previous, &next};
+	MotionField* fields[2] = {&forward_field, &backward_field};
+	MotionField* previous_fields[2] = {&previous_field, &previous_backward_field};
+	bool* scene_changes[2] = {&statistics.scene_change, &statistics.backward_scene_change};
+	int* global_x[2] = {&statistics.global_x, &statistics.backward_global_x};
+	int* global_y[2] = {&statistics.global_y, &statistics.backward_global_y};
+	Search_Reference searches[2];
+	int search_count = 0;
+	for (int direction = 0; direction<2; direction++)
+	{
+		if(parameters.scene_change_threshold > 0)
+		{
+			TRACE_SCOPE("Scene Change Detection");
+			int histogram_difference = Histogram_Difference(*frames[direction], current);
+			*scene_changes[direction] = (histogram_difference >= parameters.scene_change_threshold);
+			if(direction == 0)
+			{
+				statistics.histogram_difference = histogram_difference;
+			}
+		}
+		if(*scene_changes[direction])
+		{
+			Zero_Motion(*frames[direction], current, *fields[direction]);
+			continue;
+		}
+
+		if(parameters.global_range > 0)
+		{
+			TRACE_SCOPE("Global Motion");
+			Global_Motion(*frames[direction], current, parameters.global_range, *global_x[direction], *global_y[direction]);
+		}
+		Search_Reference search = {frames[direction], fields[direction], previous_fields[direction], *global_x[direction], *global_y[direction],
+				previous_fields[direction]};
+		searches[search_count] = search;
+		search_count++;
+	}
+	if(search_count > 0)
+	{
+		statistics.skipped_blocks = Search_Frame(searches, search_count, current);
+	}
+
+	for (int direction = 0; direction<2; direction++)
+	{
+		if(*scene_changes[direction])
+		{
+			previous_fields[direction]->resize(0, 0);
+		}
+		else
+		{
+			*previous_fields[direction] = *fields[direction];
+		}
+	}
+}
+
+//Function used to compute the data of a frame used by the scene change detection and the global motion, if enabled
+//Inputs: frame, whose data is set
+//Output: None
+void MotionEstimator::Derive_Frame(Derived_Frame &data) const
+{
+	if(parameters.global_range > 0)
+	{
+		Get_Profiles(data.frame, data);
+	}
+	if(parameters.scene_change_threshold > 0)
+	{
+		Get_Histogram(data.frame, data);
+	}
+}
+
+//Function used to get a reference frame of the last frame given to estimate_next from the ring buffer
+//Inputs: index of the reference (0 for the frame before it)
+//Output: the reference frame and its data
+const Derived_Frame& MotionEstimator::Get_Reference(int reference) const
+{
+	const int ring_size = int(frame_ring.size());
+	return frame_ring[(newest_frame-1-reference+ring_size) % ring_size];
+}
+
+bool MotionEstimator::estimate_next(const jbutil::image<int> &frame, MotionField &field)
+{
+	{
+		TRACE_SCOPE("Linearize");
+		Linearize_Image(frame, current_frame);
+	}
+	return estimate_next(current_frame, field);
+}
+
+bool MotionEstimator::estimate_next(const Linear_Frame &frame, MotionField &field)
+{
+	//the ring holds the references and the current frame, which takes the slot of the oldest frame
+	const int references = std::min(std::max(parameters.reference_frames, 1), MAX_REFERENCE_FRAMES);
+	const int ring_size = references+1;
+	if(int(frame_ring.size()) != ring_size)
+	{
+		frame_ring.resize(ring_size);
+		newest_frame = 0;
+		frame_count = 0;
+	}
+	newest_frame = (newest_frame+1) % ring_size;
+	Derived_Frame &current = frame_ring[newest_frame];
+	{
+		TRACE_SCOPE("Derive Frame");
+		current.frame = frame;
+		Derive_Frame(current);
+	}
+
+	//a frame of another size starts a new sequence
+	if((frame_count > 0) && ((Get_Reference(0).frame.rows != frame.rows) || (Get_Reference(0).frame.cols != frame.cols) ||
+			(Get_Reference(0).frame.channels != frame.channels)))
+	{
+		frame_count = 0;
+	}
+	frame_count = std::min(frame_count+1, ring_size);
+	const int reference_count = frame_count-1;
+	if(reference_count == 0)
+	{
+		previous_reference_fields.clear();
+		return false;
+	}
+
+	const int blocks_x = frame.cols/parameters.block_width;
+	const int blocks_y = frame.rows/parameters.block_height;
+	field.resize(blocks_x, blocks_y, true, true);
+	Select_Kernels(frame.channels);
+	statistics = Motion_Statistics();
+	statistics.blocks = blocks_x*blocks_y;
+
+	//the hashes of the incremental mode are not kept up to date, so a later pair must not compare with them
+	current_hashes.clear();
+	reference_hashes.clear();
+	dirty_blocks = NULL;
+
+	//every reference has its own scene change test and global motion, from the data derived when it was the current frame
+	reference_fields.resize(reference_count);
+	previous_reference_fields.resize(reference_count);
+	Search_Reference searches[MAX_REFERENCE_FRAMES];
+	bool scene_changes[MAX_REFERENCE_FRAMES];
+	int search_count = 0;
+	for (int reference = 0; reference<reference_count; reference++)
+	{
+		const Derived_Frame &data = Get_Reference(reference);
+		reference_fields[reference].resize(blocks_x, blocks_y, true);
+		scene_changes[reference] = false;
+		if(parameters.scene_change_threshold > 0)
+		{
+			int histogram_difference = Histogram_Difference(data, current);
+			scene_changes[reference] = (histogram_difference >= parameters.scene_change_threshold);
+			if(reference == 0)
+			{
+				statistics.histogram_difference = histogram_difference;
+			}
+		}
+		if(scene_changes[reference])
+		{
+			continue;
+		}
+
+		int global_x = 0;
+		int global_y = 0;
+		if(parameters.global_range > 0)
+		{
+			TRACE_SCOPE("Global Motion");
+			Global_Motion(data.frame, data, current.frame, current, parameters.global_range, global_x, global_y);
+		}
+		if(reference == 0)
+		{
+			statistics.global_x = global_x;
+			statistics.global_y = global_y;
+		}
+		Search_Reference search = {&data.frame, &reference_fields[reference], &previous_reference_fields[reference], global_x, global_y,
+				&previous_reference_fields[reference]};
+		searches[search_count] = search;
+		search_count++;
+	}
+
+	//no reference is useful if every one of them is a scene change
+	if(search_count == 0)
+	{
+		statistics.scene_change = true;
+		Zero_Motion(Get_Reference(0).frame, current.frame, field);
+		for (int block = 0; block<blocks_x*blocks_y; block++)
+		{
+			field.reference(block%blocks_x, block/blocks_x) = 0;
+		}
+		previous_reference_fields.clear();
+		return true;
+	}
+	statistics.skipped_blocks = Search_Frame(searches, search_count, current.frame);
+
+	//every macroblock takes the reference of the least cost, the newest among equal costs
+	for (int y = 0; y<blocks_y; y++)
+	{
+		for (int x = 0; x<blocks_x; x++)
+		{
+			int best = -1;
+			for (int reference = 0; reference<reference_count; reference++)
+			{
+				if(!scene_changes[reference] && ((best < 0) || (reference_fields[reference].cost(x, y) < reference_fields[best].cost(x, y))))
+				{
+					best = reference;
+				}
+			}
+			field.motion_vector_x(x, y) = reference_fields[best].motion_vector_x(x, y);
+			field.motion_vector_y(x, y) = reference_fields[best].motion_vector_y(x, y);
+			field.cost(x, y) = reference_fields[best].cost(x, y);
+			field.reference(x, y) = uint8_t(best);
+		}
+	}
+
+	//the field of every reference gives the temporal predictors of the same reference of the next frame
+	previous_reference_fields.swap(reference_fields);
+	for (int reference = 0; reference<reference_count; reference++)
+	{
+		if(scene_changes[reference])
+		{
+			previous_reference_fields[reference].resize(0, 0);
+		}
+	}
+	return true;
+}
+
+void MotionEstimator::reconstruct_next(const MotionField &field, Linear_Frame &reconstructed) const
+{
+	TRACE_SCOPE("Reconstruction");
+	const Linear_Frame* references[MAX_REFERENCE_FRAMES];
+	for (int reference = 0; reference<frame_count-1; reference++)
+	{
+		references[reference] = &Get_Reference(reference).frame;
+	}
+	Compensate_Frame(references, field, parameters.block_width, parameters.block_height, parameters.overlapped, scheduler, rows_per_task,
+			reconstructed, NULL);
+}
+
+//Function used to search every macroblock of a frame in a list of references, on the calling thread or as tasks of the
+//scheduler
+//Inputs: references to be searched, number of references, Frame to be Predicted
+//Output: number of searches skipped by the zero motion test
+int MotionEstimator::Search_Frame(const Search_Reference* references, int reference_count, const Linear_Frame &current)
+{
+	const int blocks_y = references[0].field->get_blocks_y();
+	if((scheduler == NULL) || (blocks_y == 1) || (!parameters.predictors && (blocks_y <= rows_per_task)))
+	{
+		TRACE_SCOPE_ARG("Search Rows", 0);
+		return Search_Rows(references, reference_count, current, 0, blocks_y, &macroblock[0], NULL);
+	}
+	else if(parameters.predictors)
+	{
+		return Wavefront_Search(references, reference_count, current);
+	}
+
+	//every chunk of macroblock rows is a task with its own packed macroblock; without predictors the macroblocks
+	//are independent, so the motion field is the same whichever thread runs a chunk
+	std::atomic<int> skipped_blocks(0);
+	Task_Group chunks;
+	for (int row_start = 0; row_start<blocks_y; row_start = row_start+rows_per_task)
+	{
+		int row_stop = (row_start+rows_per_task < blocks_y) ? row_start+rows_per_task : blocks_y;
+		scheduler->Submit(chunks, [this, references, reference_count, &current, &skipped_blocks, row_start, row_stop]()
+		{
+			TRACE_SCOPE_ARG("Search Rows", row_start);
+			jbutil::vector<int> chunk_macroblock(Get_Macroblock_Size(current.channels));
+			skipped_blocks.fetch_add(Search_Rows(references, reference_count, current, row_start, row_stop, &chunk_macroblock[0], NULL));
+		});
+	}
+	scheduler->Wait(chunks);
+	return skipped_blocks.load();
+}
+
+//Function used to get the number of integers of a packed macroblock buffer: the macroblock, followed by the decimated
+//macroblock with pre-screening
+//Inputs: number of channels
+//Output: the size of the buffer
+int MotionEstimator::Get_Macroblock_Size(int channels) const
+{
+	int size = parameters.block_width*parameters.block_height*channels;
+	if(parameters.prescreen_candidates > 0)
+	{
+		size = size + parameters.block_width*(parameters.block_height/2)*channels;
+	}
+	return size;
+}
+
+void MotionEstimator::get_search_reach(int &reach_x, int &reach_y) const
+{
+	const int steps = Get_Step_Count(parameters.search_horizontal, parameters.search_vertical);
+	reach_x = Get_Search_Reach(parameters.search_horizontal, steps);
+	reach_y = Get_Search_Reach(parameters.search_vertical, steps);
+}
+
+//Function used to get how far to the left and above a macroblock its search blocks can be: the steps added to the start
+//position, which is at most the search range away with predictors
+//Inputs: reach along x and y to be set, in pixels
+//Output: None
+void MotionEstimator::Get_Window_Reach(int &reach_x, int &reach_y) const
+{
+	const int steps = Get_Step_Count(parameters.search_horizontal, parameters.search_vertical);
+	reach_x = Get_Search_Reach(parameters.search_horizontal, steps) + (parameters.predictors ? parameters.search_horizontal : 0);
+	reach_y = Get_Search_Reach(parameters.search_vertical, steps) + (parameters.predictors ? parameters.search_vertical : 0);
+}
+
+void MotionEstimator::get_strip_margins(int &margin_above, int &margin_below) const
+{
+	int reach_x;
+	Get_Window_Reach(reach_x, margin_above);
+	margin_below = parameters.search_vertical;
+}
+
+void MotionEstimator::estimate_rows(const Linear_Frame &reference, const Linear_Frame &current, int row_start, int row_stop, MotionField &field)
+{
+	const int blocks_y = current.rows/parameters.block_height;
+	if(row_start == 0)
+	{
+		field.resize(current.cols/parameters.block_width, blocks_y, true);
+		Select_Kernels(current.channels);
+		statistics = Motion_Statistics();
+		statistics.blocks = field.get_blocks_x()*blocks_y;
+		current_hashes.clear();
+		reference_hashes.clear();
+		dirty_blocks = NULL;
+		Row_Progress_Array(blocks_y).swap(strip_progress);
+		for (int y = 0; y<blocks_y; y++)
+		{
+			strip_progress[y].blocks.store(0);
+		}
+	}
+
+	//the rows are searched as rows of a wavefront search whose rows above are finished, such that the predictors of the
+	//first row searched come from the rows above it, as in a search of the whole frame
+	Search_Reference search = {&reference, &field, &previous_field, 0, 0, &previous_field};
+	statistics.skipped_blocks = statistics.skipped_blocks + Search_Rows(&search, 1, current, row_start, row_stop, &macroblock[0], &strip_progress[0]);
+
+	if(row_stop == blocks_y)
+	{
+		previous_field = field;
+		Row_Progress_Array().swap(strip_progress);
+	}
+}
+
+//Function used to hash every macroblock of a frame, keeping the hashes of the previous frame given
+//Inputs: frame, hashes to be set (one per macroblock), hashes to be set to the previous hashes
+//Output: None
+void MotionEstimator::Hash_Blocks(const Linear_Frame &frame, std::vector<uint64_t> &hashes, std::vector<uint64_t> &previous_hashes)
+{
+	const int block_width = parameters.block_width;
+	const int block_height = parameters.block_height;
+	const int blocks_x = frame.cols/block_width;
+	const int blocks_y = frame.rows/block_height;
+
+	previous_hashes.swap(hashes);
+	hashes.resize(blocks_x*blocks_y);
+	for (int y = 0; y<blocks_y; y++)
+	{
+		//the pixels past the last whole macroblock can be searched, so they are hashed with the last macroblock
+		const int rows = (y == blocks_y-1) ? frame.rows-y*block_height : block_height;
+		for (int x = 0; x<blocks_x; x++)
+		{
+			const int row_length = ((x == blocks_x-1) ? frame.cols-x*block_width : block_width)*frame.channels;
+
+			//FNV-1a over the samples of the block
+			uint64_t hash = 14695981039346656037ULL;
+			for (int row = 0; row<rows; row++)
+			{
+				const int* samples = frame.pixel(y*block_height+row, x*block_width);
+				for (int i = 0; i<row_length; i++)
+				{
+					hash = (hash ^ uint64_t(samples[i]))*1099511628211ULL;
+				}
+			}
+			hashes[x+y*blocks_x] = hash;
+		}
+	}
+}
+
+//Function used to find the macroblocks which have to be searched in incremental mode. A macroblock is searched again
+//if it changed since the previous current frame, or if any reference block its search can reach changed since the
+//previous reference frame; any other macroblock would be searched in the same pixels as in the previous pair (which must
+//have had the same global motion vector), so its vector is carried forward. With the predictors or the adaptive ranges,
+//a carried vector may differ from the one a search would give, as the vectors around its macroblock may have changed.
+//Inputs: Reference Frame, motion field (for its size)
+//Output: True if the dirty macroblocks were marked, False if there is no previous pair of the same size to compare with
+bool MotionEstimator::Mark_Dirty_Blocks(const Linear_Frame &reference, const MotionField &field)
+{
+	const int block_width = parameters.block_width;
+	const int block_height = parameters.block_height;
+	const int blocks_x = field.get_blocks_x();
+	const int blocks_y = field.get_blocks_y();
+	if((previous_field.get_blocks_x() != blocks_x) || (previous_field.get_blocks_y() != blocks_y) ||
+			(int(previous_current_hashes.size()) != blocks_x*blocks_y) || (int(previous_reference_hashes.size()) != blocks_x*blocks_y))
+	{
+		return false;
+	}
+
+	//the reference blocks overlapped by the search of a macroblock, as in Three_Step_Search
+	const int steps = Get_Step_Count(parameters.search_horizontal, parameters.search_vertical);
+	const int reach_x = Get_Search_Reach(parameters.search_horizontal, steps) + (parameters.predictors ? parameters.search_horizontal : 0);
+	const int reach_y = Get_Search_Reach(parameters.search_vertical, steps) + (parameters.predictors ? parameters.search_vertical : 0);
+
+	dirty.assign(blocks_x*blocks_y, 0);
+	statistics.dirty_blocks = 0;
+	for (int y = 0; y<blocks_y; y++)
+	{
+		for (int x = 0; x<blocks_x; x++)
+		{
+			bool changed = (current_hashes[x+y*blocks_x] != previous_current_hashes[x+y*blocks_x]);
+
+			int centre_x = Get_Search_Centre(x*block_width, statistics.global_x, block_width, reference.cols);
+			int centre_y = Get_Search_Centre(y*block_height, statistics.global_y, block_height, reference.rows);
+			int x_start = std::max(std::min(x*block_width, centre_x)-reach_x, 0)/block_width;
+			int x_stop = std::min(std::min(std::max(x*block_width, centre_x)+block_width+parameters.search_horizontal-1, reference.cols-1)/block_width, blocks_x-1);
+			int y_start = std::max(std::min(y*block_height, centre_y)-reach_y, 0)/block_height;
+			int y_stop = std::min(std::min(std::max(y*block_height, centre_y)+block_height+parameters.search_vertical-1, reference.rows-1)/block_height, blocks_y-1);
+			for (int reference_y = y_start; (reference_y<=y_stop) && !changed; reference_y++)
+			{
+				for (int reference_x = x_start; (reference_x<=x_stop) && !changed; reference_x++)
+				{
+					int index = reference_x+reference_y*blocks_x;
+					changed = (reference_hashes[index] != previous_reference_hashes[index]);
+				}
+			}
+
+			if(changed)
+			{
+				dirty[x+y*blocks_x] = 1;
+				statistics.dirty_blocks++;
+			}
+		}
+	}
+	return true;
+}
+
+//Function used to search the macroblocks in wavefront order, such that the spatial predictors are the same as in a
+//serial search. A macroblock depends on its left and top right neighbours (and so on its top neighbour), so the rows
+//are searched by one worker each, and a worker goes on to the next macroblock of its row once the row above has
+//finished the macroblock above and to the right of it: the macroblocks on an anti-diagonal are searched in parallel.
+//Every row has a counter of finished macroblocks, written by its worker only and read by the worker of the next row.
+//Inputs: references to be searched, number of references, Frame to be Predicted
+//Output: number of searches skipped by the zero motion test
+int MotionEstimator::Wavefront_Search(const Search_Reference* references, int reference_count, const Linear_Frame &current)
+{
+	const int blocks_y = references[0].field->get_blocks_y();
+	Row_Progress_Array progress(blocks_y);
+	for (int row = 0; row<blocks_y; row++)
+	{
+		progress[row].blocks.store(0, std::memory_order_relaxed);
+	}
+
+	//the rows are taken in order, so the row a worker waits for has always been taken by a running worker
+	std::atomic<int> next_row(0);
+	std::atomic<int> skipped_blocks(0);
+	Task_Group workers;
+	int worker_count = (scheduler->get_threads() < blocks_y) ? scheduler->get_threads() : blocks_y;
+	for (int worker = 0; worker<worker_count; worker++)
+	{
+		scheduler->Submit(workers, [this, references, reference_count, &current, &progress, &next_row, &skipped_blocks, blocks_y]()
+		{
+			jbutil::vector<int> worker_macroblock(Get_Macroblock_Size(current.channels));
+			for (int row = next_row.fetch_add(1); row<blocks_y; row = next_row.fetch_add(1))
+			{
+				TRACE_SCOPE_ARG("Wavefront Row", row);
+				skipped_blocks.fetch_add(Search_Rows(references, reference_count, current, row, row+1, &worker_macroblock[0], &progress[0]));
+			}
+		});
+	}
+	scheduler->Wait(workers);
+	return skipped_blocks.load();
+}
+
+int MotionEstimator::Search_Rows(const Search_Reference* references, int reference_count, const Linear_Frame &current, int row_start, int row_stop, int* macroblock, Row_Progress* progress)
+{
+	switch(parameters.engine)
+	{
+		case ENGINE_THREE_STEP_SEARCH:
+		default:
+			return Three_Step_Search(references, reference_count, current, row_start, row_stop, macroblock, progress);
+	}
+}
+
+MotionField MotionEstimator::estimate(const jbutil::image<int> &reference, const jbutil::image<int> &current)
+{
+	MotionField field;
+	estimate(reference, current, field);
+	return field;
+}
+
+void MotionEstimator::reconstruct(const jbutil::image<int> &reference, const MotionField &field, jbutil::image<int> &reconstructed)
+{
+	TRACE_SCOPE("Reconstruction");
+	if(!parameters.overlapped)
+	{
+		Compensate_Image(reference, field, parameters.block_width, parameters.block_height, scheduler, rows_per_task, reconstructed);
+		return;
+	}
+
+	Linearize_Image(reference, reference_frame);
+	reconstructed_frame.resize(reference_frame.rows, reference_frame.cols, reference_frame.channels);
+	const Linear_Frame* references[1] = {&reference_frame};
+	Compensate_Frame(references, field, parameters.block_width, parameters.block_height, true, scheduler, rows_per_task,
+			reconstructed_frame, &reconstructed);
+}
+
+jbutil::image<int> MotionEstimator::reconstruct(const jbutil::image<int> &reference, const MotionField &field)
+{
+	jbutil::image<int> reconstructed(reference.get_rows(), reference.get_cols(), reference.channels());
+	reconstruct(reference, field, reconstructed);
+	return reconstructed;
+}
+
+void MotionEstimator::reconstruct(const jbutil::image<int> &previous, const jbutil::image<int> &next, const MotionField &forward_field,
+		const MotionField &backward_field, jbutil::image<int> &reconstructed)
+{
+	TRACE_SCOPE("Reconstruction");
+	Compensate_Bidirectional_Image(previous, next, forward_field, backward_field, parameters.block_width, parameters.block_height,
+			scheduler, rows_per_task, reconstructed);
+}
+
+//Function used to get the median of 3 values
+static int Median(int a, int b, int c)
+{
+	return std::max(std::min(a, b), std::min(std::max(a, b), c));
+}
+
+//Function used to get the adaptive search range of a macroblock along both axes, from the vectors around it: those of
+//its 3x3 neighbourhood in the previous pair (if there is one of the same size) and, with predictors, those of its left,
+//top and top right neighbours which are solved. Along each axis, the range covers the mean distance of the vectors from
+//the global motion vector plus twice their standard deviation, and a pixel for the search to settle.
+//Inputs: motion field being set, motion field of the previous pair (NULL if none), macroblock co-ordinates, first
+//        macroblock row being searched (NULL previous field and a negative row_start to use no vectors), global motion vector,
+//        minimum and maximum ranges along x and y, ranges to be set
+//Output: None
+static void Get_Adaptive_Range(const MotionField &field, const MotionField* previous_field, int x, int y, int row_start,
+		int global_x, int global_y, int minimum, int maximum_x, int maximum_y, int &range_x, int &range_y)
+{
+	int count = 0;
+	int sum_x = 0, sum_y = 0;
+	int sum_squares_x = 0, sum_squares_y = 0;
+	//adds the distance of a vector from the global motion vector
+	auto add = [&](int vector_x, int vector_y)
+	{
+		int distance_x = std::abs(vector_x - global_x);
+		int distance_y = std::abs(vector_y - global_y);
+		sum_x = sum_x + distance_x;
+		sum_y = sum_y + distance_y;
+		sum_squares_x = sum_squares_x + distance_x*distance_x;
+		sum_squares_y = sum_squares_y + distance_y*distance_y;
+		count++;
+	};
+
+	if(previous_field != NULL)
+	{
+		for (int neighbour_y = std::max(y-1, 0); neighbour_y<=std::min(y+1, previous_field->get_blocks_y()-1); neighbour_y++)
+		{
+			for (int neighbour_x = std::max(x-1, 0); neighbour_x<=std::min(x+1, previous_field->get_blocks_x()-1); neighbour_x++)
+			{
+				add(previous_field->motion_vector_x(neighbour_x, neighbour_y), previous_field->motion_vector_y(neighbour_x, neighbour_y));
+			}
+		}
+	}
+	if(row_start >= 0)
+	{
+		if(x > 0)
+		{
+			add(field.motion_vector_x(x-1, y), field.motion_vector_y(x-1, y));
+		}
+		if(y > row_start)
+		{
+			add(field.motion_vector_x(x, y-1), field.motion_vector_y(x, y-1));
+			if(x+1 < field.get_blocks_x())
+			{
+				add(field.motion_vector_x(x+1, y-1), field.motion_vector_y(x+1, y-1));
+			}
+		}
+	}
+
+	if(count == 0)
+	{
+		//nothing is known about the motion around the macroblock
+		range_x = maximum_x;
+		range_y = maximum_y;
+		return;
+	}
+	double mean_x = double(sum_x)/count;
+	double mean_y = double(sum_y)/count;
+	double deviation_x = std::sqrt(std::max(double(sum_squares_x)/count - mean_x*mean_x, 0.0));
+	double deviation_y = std::sqrt(std::max(double(sum_squares_y)/count - mean_y*mean_y, 0.0));
+	range_x = std::min(std::max(int(std::ceil(mean_x + 2.0*deviation_x)) + 1, std::min(minimum, maximum_x)), maximum_x);
+	range_y = std::min(std::max(int(std::ceil(mean_y + 2.0*deviation_y)) + 1, std::min(minimum, maximum_y)), maximum_y);
+}
+
+//Function used to get the spatial predictor of a macroblock: the median of the vectors of its left, top and top right
+//neighbours. Only the neighbours in the rows being searched (from row_start) are used, such that the predictor does not
+//depend on the order in which chunks of rows are searched; a missing neighbour counts as a zero vector, unless the left
+//neighbour is the only one, in which case its vector is used.
+//Inputs: motion field being set, macroblock co-ordinates, first macroblock row being searched, predictor to be set
+//Output: None
+static void Get_Median_Predictor(const MotionField &field, int x, int y, int row_start, int &predictor_x, int &predictor_y)
+{
+	bool has_left = (x > 0);
+	bool has_top = (y > row_start);
+	bool has_top_right = has_top && (x+1 < field.get_blocks_x());
+
+	if(has_left && !has_top)
+	{
+		predictor_x = field.motion_vector_x(x-1, y);
+		predictor_y = field.motion_vector_y(x-1, y);
+		return;
+	}
+
+	int left_x = has_left ? field.motion_vector_x(x-1, y) : 0;
+	int left_y = has_left ? field.motion_vector_y(x-1, y) : 0;
+	int top_x = has_top ? field.motion_vector_x(x, y-1) : 0;
+	int top_y = has_top ? field.motion_vector_y(x, y-1) : 0;
+	int top_right_x = has_top_right ? field.motion_vector_x(x+1, y-1) : 0;
+	int top_right_y = has_top_right ? field.motion_vector_y(x+1, y-1) : 0;
+	predictor_x = Median(left_x, top_x, top_right_x);
+	predictor_y = Median(left_y, top_y, top_right_y);
+}
+
+//Function used in a wavefront search to wait until the left and top right neighbours of a macroblock are solved
+//Inputs: progress counters of the macroblock rows, number of macroblocks in a row, macroblock co-ordinates
+//Output: None
+static void Wait_For_Neighbours(const Row_Progress* progress, int blocks_x, int x, int y)
+{
+	//the left neighbour is solved by the same worker; the top right one needs x+2 finished macroblocks in the row above
+	if(y == 0)
+	{
+		return;
+	}
+	const int needed = (x+2 < blocks_x) ? x+2 : blocks_x;
+	while(progress[y-1].blocks.load(std::memory_order_acquire) < needed)
+	{
+		std::this_thread::yield();
+	}
+}
+
+//Function to perform the block matching algorithm using a logarithmic search: the three step search for a range of 8,
+//with a step more for every doubling of the range. Every macroblock is packed once and searched in every reference.
+//Inputs: references to be searched (frames, motion fields to be set, fields of the previous pair and global motion
+//        vectors), number of references, Frame to be Predicted, first and last (exclusive) macroblock row,
+//        buffer for the packed macroblock, progress counters of the macroblock rows for a wavefront search (NULL if not)
+//Output: number of searches skipped by the zero motion test
+int MotionEstimator::Three_Step_Search(const Search_Reference* references, int reference_count, const Linear_Frame &frame_2, int row_start, int row_stop, int* macroblock, Row_Progress* progress)
+{
+	const int block_width = parameters.block_width;
+	const int block_height = parameters.block_height;
+	const int search_horizontal = parameters.search_horizontal;
+	const int search_vertical = parameters.search_vertical;
+
+	//the skip threshold is a mean cost per sample, compared as a sum over all the samples of a block
+	const uint32_t skip_cost = uint32_t(parameters.skip_threshold)*uint32_t(block_width*block_height*frame_2.channels);
+	int skipped_blocks = 0;
+
+	//in a wavefront search the neighbours in the rows above are solved first, otherwise only those in the rows being searched
+	const int predictor_row_start = (progress != NULL) ? 0 : row_start;
+
+	//The search blocks are at most search_area_stop to the right and below, and the reach to the left and above: this is the
+	//window of a macroblock. With global motion, the window spans those of the co-located block and of the centre block
+	int reach_x, reach_y;
+	Get_Window_Reach(reach_x, reach_y);
+	int global_x = 0;
+	int global_y = 0;
+	for (int reference = 0; reference<reference_count; reference++)
+	{
+		global_x = std::max(global_x, std::abs(references[reference].global_x));
+		global_y = std::max(global_y, std::abs(references[reference].global_y));
+	}
+
+	//The macroblocks are visited in the traversal order. The predictors need the left, top and top right neighbours of a
+	//macroblock to be solved first, and the sliding window needs the macroblocks of a row from left to right, so with
+	//predictors the order is always raster, and the window is only used in raster order. The tiles are sized such that
+	//the windows of every reference fit in the cache
+	const Traversal_Order order = parameters.predictors ? TRAVERSAL_RASTER : parameters.traversal;
+	const int blocks_x = references[0].field->get_blocks_x();
+	const int tile_size = (parameters.tile_size > 0) ? parameters.tile_size :
+			Get_Tile_Size(block_width, block_height, reach_x+global_x, reach_y+global_y, reference_count*frame_2.channels, TILE_CACHE_SIZE);
+	std::vector<int> traversal;
+	Get_Traversal(order, blocks_x, row_start, row_stop, tile_size, traversal);
+
+	//pre-screening: the decimated macroblock follows the macroblock in its buffer
+	const bool prescreen = (parameters.prescreen_candidates > 0);
+	int* decimated_macroblock = macroblock + block_width*block_height*frame_2.channels;
+
+	//every reference has its own window
+	std::vector<Reference_Window> windows;
+	std::vector<int> window_rows(reference_count, -1);
+	windows.reserve(reference_count);
+	for (int reference = 0; reference<reference_count; reference++)
+	{
+		windows.emplace_back(*references[reference].frame, parameters.sliding_window && (order == TRAVERSAL_RASTER),
+				reach_y+global_y+block_height+search_vertical, reach_x+global_x+block_width+search_horizontal);
+	}
+
+	//For each macroblock
+	for (size_t block = 0; block<traversal.size(); block++)
+	{
+		const int block_x = traversal[block]%blocks_x;
+		const int block_y = traversal[block]/blocks_x;
+		const int macroblock_x = block_x*block_width;
+		const int macroblock_y = block_y*block_height;
+
+		if(progress != NULL)
+		{
+			Wait_For_Neighbours(progress, blocks_x, block_x, block_y);
+		}
+
+		//Incremental mode (a single reference): a macroblock which would be searched in the same pixels as in the
+		//previous pair keeps its vector
+		if((dirty_blocks != NULL) && !dirty_blocks[block_x+block_y*blocks_x])
+		{
+			MotionField &field = *references[0].field;
+			field.motion_vector_x(block_x, block_y) = references[0].previous_field->motion_vector_x(block_x, block_y);
+			field.motion_vector_y(block_x, block_y) = references[0].previous_field->motion_vector_y(block_x, block_y);
+			field.cost(block_x, block_y) = references[0].previous_field->cost(block_x, block_y);
+			if(progress != NULL)
+			{
+				progress[block_y].blocks.store(block_x+1, std::memory_order_release);
+			}
+			continue;
+		}
+
+		//Set the pixel values for the macroblock
+		kernels->Set_Block(frame_2.pixel(macroblock_y, macroblock_x), frame_2.stride(), macroblock, block_width, block_height, frame_2.channels);
+		if(prescreen)
+		{
+			//every other row of the macroblock, packed after it
+			const int row_length = block_width*frame_2.channels;
+			for (int row = 0; row<block_height/2; row++)
+			{
+				std::memcpy(decimated_macroblock + row*row_length, macroblock + 2*row*row_length, row_length*sizeof(int));
+			}
+		}
+
+		for (int reference = 0; reference<reference_count; reference++)
+		{
+			const Linear_Frame &frame_1 = *references[reference].frame;
+			MotionField &field = *references[reference].field;
+			Reference_Window &window = windows[reference];
+
+			//the vectors of the previous pair are used as temporal predictors and set the adaptive ranges if they are
+			//for frames of the same size
+			const MotionField* temporal_field = references[reference].temporal_field;
+			if((temporal_field != NULL) && ((temporal_field->get_blocks_x() != field.get_blocks_x()) || (temporal_field->get_blocks_y() != field.get_blocks_y())))
+			{
+				temporal_field = NULL;
+			}
+			const bool temporal = parameters.predictors && (temporal_field != NULL);
+
+			//the search can also start from the centre block: the macroblock moved by the global motion vector
+			const int centre_x = Get_Search_Centre(macroblock_x, references[reference].global_x, block_width, frame_1.cols);
+			const int centre_y = Get_Search_Centre(macroblock_y, references[reference].global_y, block_height, frame_1.rows);
+			const bool centred = (centre_x == macroblock_x) && (centre_y == macroblock_y);
+
+			//set the search are start and stop co-ordinates
+			int search_area_y_stop 		= Get_Search_Area_Stop(frame_1.rows, search_vertical, std::max(macroblock_y, centre_y), block_height);
+			if(block_y != window_rows[reference])
+			{
+				window.set_rows(std::max(std::min(macroblock_y, centre_y)-reach_y, 0), search_area_y_stop);
+				window_rows[reference] = block_y;
+			}
+			int search_area_x_stop 		= Get_Search_Area_Stop(frame_1.cols, search_horizontal, std::max(macroblock_x, centre_x), block_width);
+			window.set_columns(std::max(std::min(macroblock_x, centre_x)-reach_x, 0), search_area_x_stop);
+
+			//The median predictor, which is also the vector from which the rate term is measured
+			int median_x = 0;
+			int median_y = 0;
+			if(parameters.predictors)
+			{
+				Get_Median_Predictor(field, block_x, block_y, predictor_row_start, median_x, median_y);
+			}
+			const int rate_lambda = parameters.rate_lambda;
+			auto rate = [rate_lambda, median_x, median_y](int vector_x, int vector_y)
+			{
+				return uint32_t(rate_lambda*(std::abs(vector_x-median_x) + std::abs(vector_y-median_y)));
+			};
+
+			//The cost of the co-located block, used by the zero motion skip and as the zero predictor
+			uint32_t zero_MSE = 0;
+			if((parameters.skip_threshold > 0) || parameters.predictors || !centred)
+			{
+				zero_MSE = cost(macroblock, window.pixel(macroblock_y, macroblock_x), window.stride(), block_width, block_height, frame_1.channels);
+			}
+
+			//Zero motion skip: if the co-located block is already a close enough match, the macroblock is not searched.
+			//The test is on the distortion alone
+			if((parameters.skip_threshold > 0) && (zero_MSE < skip_cost))
+			{
+				field.motion_vector_x(block_x, block_y) = 0;
+				field.motion_vector_y(block_x, block_y) = 0;
+				field.cost(block_x, block_y) = zero_MSE;
+				skipped_blocks++;
+				continue;
+			}
+
+			zero_MSE = zero_MSE + rate(0, 0);
+
+			uint32_t least_MSE = std::numeric_limits<uint32_t>::max();	//The lowest cost (eg: MSE as a sum of squared errors) found for the macroblock
+			int least_MSE_x = macroblock_x;		//The top left column coordinate of the search block with the lowest MSE
+			int least_MSE_y = macroblock_y;		//The top left row coordinate of the search block with the lowest MSE
+			int new_least_MSE_x = 0;								//These 2 values are temporary values which are updated if a lower MSE search block is
+			int new_least_MSE_y = 0;								//found. These are needed since, for a single iteration least_MSE_x and y are constant
+
+			//Global motion: the search starts from the better of the co-located block and the centre block, such that
+			//the macroblocks which do not follow the global motion are still found
+			uint32_t centre_MSE = zero_MSE;
+			if(!centred)
+			{
+				centre_MSE = cost(macroblock, window.pixel(centre_y, centre_x), window.stride(), block_width, block_height, frame_1.channels) +
+						rate(centre_x-macroblock_x, centre_y-macroblock_y);
+				if(centre_MSE < zero_MSE)
+				{
+					least_MSE_x = centre_x;
+					least_MSE_y = centre_y;
+				}
+			}
+
+			//Predictors: the search starts from the best of the zero vector, the centre block, the median of the solved
+			//neighbours and the co-located vector of the previous pair, instead of always starting from the co-located block
+			if(parameters.predictors)
+			{
+				int predictor_x[3] = {0, 0, 0};
+				int predictor_y[3] = {0, 0, 0};
+				int predictors = 2;
+				predictor_x[1] = median_x;
+				predictor_y[1] = median_y;
+				if(temporal)
+				{
+					predictor_x[2] = temporal_field->motion_vector_x(block_x, block_y);
+					predictor_y[2] = temporal_field->motion_vector_y(block_x, block_y);
+					predictors = 3;
+				}
+
+				least_MSE = std::min(zero_MSE, centre_MSE);
+				new_least_MSE_x = least_MSE_x;
+				new_least_MSE_y = least_MSE_y;
+				for (int predictor = 1; predictor<predictors; predictor++)
+				{
+					//the predictors are kept within the search range of the co-located or the centre block, and the frame
+					int block_x_start = macroblock_x + predictor_x[predictor];
+					int block_y_start = macroblock_y + predictor_y[predictor];
+					bool in_range = ((std::abs(predictor_x[predictor]) <= search_horizontal) && (std::abs(predictor_y[predictor]) <= search_vertical)) ||
+							((std::abs(block_x_start-centre_x) <= search_horizontal) && (std::abs(block_y_start-centre_y) <= search_vertical));
+					if(!in_range ||
+							(block_x_start < 0) || (block_x_start+block_width > search_area_x_stop) || (block_y_start < 0) || (block_y_start+block_height > search_area_y_stop))
+					{
+						continue;
+					}
+
+					uint32_t predictor_MSE = cost(macroblock, window.pixel(block_y_start, block_x_start), window.stride(), block_width, block_height, frame_1.channels) +
+							rate(predictor_x[predictor], predictor_y[predictor]);
+					if(predictor_MSE < least_MSE)
+					{
+						least_MSE = predictor_MSE;
+						new_least_MSE_x = block_x_start;
+						new_least_MSE_y = block_y_start;
+					}
+				}
+				least_MSE_x = new_least_MSE_x;
+				least_MSE_y = new_least_MSE_y;
+			}
+
+
+			//Adaptive search range: the steps of the search are set from the range of the macroblock instead of the
+			//search area, which still bounds the search
+			int block_search_horizontal = search_horizontal;
+			int block_search_vertical = search_vertical;
+			if(parameters.adaptive_minimum > 0)
+			{
+				Get_Adaptive_Range(field, temporal_field, block_x, block_y, parameters.predictors ? predictor_row_start : -1,
+						references[reference].global_x, references[reference].global_y, parameters.adaptive_minimum, search_horizontal, search_vertical,
+						block_search_horizontal, block_search_vertical);
+			}
+
+			//The logarithmic search: every step tests the 9 search blocks around the best block so far, with the step
+			//distance halved at every step (4, 2, 1 for a range of 8)
+			const int block_steps = Get_Step_Count(block_search_horizontal, block_search_vertical);
+			for (int search_count = 0; search_count<block_steps; search_count++)
+			{
+				const int search_dist_x = Get_Step_Distance(block_search_horizontal, search_count);
+				const int search_dist_y = Get_Step_Distance(block_search_vertical, search_count);
+				//the search blocks of the step which are within the search area
+				int points[9];
+				int point_count = 0;
+				for (int point = 0; point<9; point++)
+				{
+					int block_x_start = least_MSE_x + STEP_PATTERN_X[point]*search_dist_x;
+					int block_y_start = least_MSE_y + STEP_PATTERN_Y[point]*search_dist_y;
+					if((block_x_start >= 0) && (block_x_start+block_width <= search_area_x_stop) && (block_y_start >= 0) && (block_y_start+block_height <= search_area_y_stop))
+					{
+						points[point_count] = point;
+						point_count++;
+					}
+				}
+
+				//Pre-screening: the search blocks are scored on every other row (twice the decimated distortion, plus the
+				//rate), and only the best ones are kept (in the order of the pattern, such that ties are broken as without
+				//pre-screening)
+				if(prescreen && (point_count > parameters.prescreen_candidates))
+				{
+					uint32_t decimated_MSE[9];
+					for (int candidate = 0; candidate<point_count; candidate++)
+					{
+						int block_x_start = least_MSE_x + STEP_PATTERN_X[points[candidate]]*search_dist_x;
+						int block_y_start = least_MSE_y + STEP_PATTERN_Y[points[candidate]]*search_dist_y;
+						decimated_MSE[points[candidate]] = 2*decimated_cost(decimated_macroblock, window.pixel(block_y_start, block_x_start),
+								2*window.stride(), block_width, block_height/2, frame_1.channels) + rate(block_x_start-macroblock_x, block_y_start-macroblock_y);
+					}
+					//selects the best search blocks one at a time, the first in the pattern among equal scores
+					bool kept[9] = {false, false, false, false, false, false, false, false, false};
+					for (int selected = 0; selected<parameters.prescreen_candidates; selected++)
+					{
+						int best = -1;
+						for (int candidate = 0; candidate<point_count; candidate++)
+						{
+							if(!kept[points[candidate]] && ((best < 0) || (decimated_MSE[points[candidate]] < decimated_MSE[best])))
+							{
+								best = points[candidate];
+							}
+						}
+						kept[best] = true;
+					}
+					point_count = 0;
+					for (int point = 0; point<9; point++)
+					{
+						if(kept[point])
+						{
+							points[point_count] = point;
+							point_count++;
+						}
+					}
+				}
+
+				//Calculate the costs of the search blocks, reading them in place, with the batch kernel which scores them in
+				//one call and returns the best one. With METRIC_SSD the sum of squared errors is used, which
+				//orders the search blocks in the same way as the MSE
+				const int* search_blocks[MAX_CANDIDATES];
+				uint32_t rates[MAX_CANDIDATES];
+				for (int candidate = 0; candidate<point_count; candidate++)
+				{
+					int block_x_start = least_MSE_x + STEP_PATTERN_X[points[candidate]]*search_dist_x;
+					int block_y_start = least_MSE_y + STEP_PATTERN_Y[points[candidate]]*search_dist_y;
+					search_blocks[candidate] = window.pixel(block_y_start, block_x_start);
+					rates[candidate] = rate(block_x_start-macroblock_x, block_y_start-macroblock_y);
+				}
+				uint32_t current_MSE = 0;
+				int best = batch_cost(macroblock, search_blocks, point_count, window.stride(), block_width, block_height, frame_1.channels, rates, current_MSE);
+
+				//If a search block with a lower cost is found (the first of the step among equal costs), update the parameters
+				if(current_MSE<least_MSE)
+				{
+					least_MSE = current_MSE;
+					//Here, cannot use least_MSE_x and least_MSE_y, since these are needed as constants in
+					//a single step loop (used when setting co-ordinates for search block)
+					new_least_MSE_x = least_MSE_x + STEP_PATTERN_X[points[best]]*search_dist_x;
+					new_least_MSE_y = least_MSE_y + STEP_PATTERN_Y[points[best]]*search_dist_y;
+				}
+
+				//Once a step is finished, update these values to represent the block with the lowest MSE
+				least_MSE_x = new_least_MSE_x;
+				least_MSE_y = new_least_MSE_y;
+			}
+
+			//By the final iteration, the least MSE block has been defined as the best MSE macroblock from those searched.
+			//therefore the motion vector can be calculated from the top left pixel location of the least mse block and the top left pixel
+			//location of the macroblock
+			field.motion_vector_x(block_x, block_y) = int16_t(least_MSE_x - macroblock_x);
+			field.motion_vector_y(block_x, block_y) = int16_t(least_MSE_y - macroblock_y);
+			field.cost(block_x, block_y) = least_MSE;
+		}
+		if(progress != NULL)
+		{
+			progress[block_y].blocks.store(block_x+1, std::memory_order_release);
+		}
+	}
+	return skipped_blocks;
+}
+
+//Function used to give every macroblock a zero motion vector, with the distortion of the co-located block
+//Inputs: Reference Frame, Frame to be Predicted, motion field to be set
+//Output: None
+void MotionEstimator::Zero_Motion(const Linear_Frame &frame_1, const Linear_Frame &frame_2, MotionField &field)
+{
+	const int block_width = parameters.block_width;
+	const int block_height = parameters.block_height;
+
+	for (int y = 0; y<field.get_blocks_y(); y++)
+	{
+		for (int x = 0; x<field.get_blocks_x(); x++)
+		{
+			kernels->Set_Block(frame_2.pixel(y*block_height, x*block_width), frame_2.stride(), &macroblock[0], block_width, block_height, frame_2.channels);
+			field.motion_vector_x(x, y) = 0;
+			field.motion_vector_y(x, y) = 0;
+			field.cost(x, y) = cost(&macroblock[0], frame_1.pixel(y*block_height, x*block_width), frame_1.stride(), block_width, block_height, frame_1.channels);
+		}
+	}
+}
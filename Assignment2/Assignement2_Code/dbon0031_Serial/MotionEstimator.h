@@ -0,0 +1,323 @@
+#ifndef __MotionEstimator_h
+#define __MotionEstimator_h
+
+#include "jbutil.h"
+#include "Block_Kernels.h"
+#include "MotionField.h"
+#include "Motion_Compensation.h"
+#include "Scheduler.h"
+#include "Traversal.h"
+#include <vector>
+#include <atomic>
+
+//The available block matching engines
+enum Motion_Engine
+{
+	ENGINE_THREE_STEP_SEARCH		//serial three step search on the CPU (a logarithmic search for ranges other than 8)
+};
+
+//largest number of reference frames of a multi-reference search
+const int MAX_REFERENCE_FRAMES = 16;
+
+//struct to hold the parameters for the algorithm: macroblock width and height, search area parameters and engine
+struct Motion_Parameters
+{
+	int block_width;
+	int block_height;
+	int search_vertical;
+	int search_horizontal;
+	Motion_Engine engine;
+
+	//zero motion skip: if the mean cost per sample of the co-located block (the zero motion vector), eg: the mean square
+	//error with METRIC_SSD, is below this threshold, the macroblock is given a zero motion vector without being searched
+	//(0 disables the test)
+	int skip_threshold;
+
+	//scene change detection: if the histograms of the two frames differ by at least this percentage of their samples,
+	//the pair is marked as a scene change and every macroblock is given a zero motion vector without being searched
+	//(0 disables the test)
+	int scene_change_threshold;
+
+	//motion vector predictors: the search of a macroblock starts from the best of the zero vector, the median of the
+	//vectors of its left, top and top right neighbours, and its vector in the previous pair given to the same object
+	bool predictors;
+
+	//sliding reference window: the search windows of a macroblock row are read from a small buffer which only loads the
+	//columns newly exposed by every macroblock, instead of from the reference frame (the motion vectors are the same)
+	bool sliding_window;
+
+	//order in which the macroblocks are searched (always raster with predictors), and tile size in macroblocks for the
+	//tiled order (0 to choose it such that the search windows of a tile fit in the L2 cache)
+	Traversal_Order traversal;
+	int tile_size;
+
+	//incremental mode: the macroblocks which did not change since the previous pair given to the same object, and whose
+	//search area did not change either, keep their vector from the previous pair instead of being searched
+	bool incremental;
+
+	//global motion: the translation of the whole frame (eg: a camera pan) is estimated from the row and column profiles of
+	//the frames, up to this many pixels along each axis, and the search of every macroblock starts from the better of the
+	//co-located block and the macroblock moved by it (0 disables the estimation)
+	int global_range;
+
+	//adaptive search range: the search range of every macroblock (and so the step sizes of its search) is set from the
+	//magnitude and the spread of the vectors around it in the previous pair, and of its solved neighbours with predictors,
+	//between this minimum and search_vertical/search_horizontal (0 disables the adaptation)
+	int adaptive_minimum;
+
+	//pre-screening: the search blocks of every step are first scored on every other row, and only this many of the best of
+	//them are scored on all their rows (0 scores every search block on all its rows; the block height must then be even)
+	int prescreen_candidates;
+
+	//metric with which the search blocks are compared with a macroblock, and weight of the rate term: the cost of a
+	//search block is its distortion plus rate_lambda*(|mv_x-p_x|+|mv_y-p_y|), where p is the median predictor with
+	//predictors and the zero vector without, such that vectors which are cheaper to code are preferred (0 disables it)
+	Cost_Metric metric;
+	int rate_lambda;
+
+	//multi-reference search (estimate_next): every macroblock is searched in up to this many of the frames before it,
+	//and is given the vector of the best of them (at most MAX_REFERENCE_FRAMES)
+	int reference_frames;
+
+	//overlapped block motion compensation: the prediction of every macroblock is blended with those given by the vectors
+	//of its neighbours, such that the reconstructed frame has no edges at the macroblock boundaries (not used by bi-prediction)
+	bool overlapped;
+
+	Motion_Parameters() :
+		block_width(8), block_height(8), search_vertical(8), search_horizontal(8), engine(ENGINE_THREE_STEP_SEARCH),
+		skip_threshold(0), scene_change_threshold(0), predictors(false), sliding_window(false), traversal(TRAVERSAL_RASTER),
+		tile_size(0), incremental(false), global_range(0), adaptive_minimum(0), prescreen_candidates(0),
+		metric(METRIC_SSD), rate_lambda(0), reference_frames(1), overlapped(false)
+	{
+	}
+};
+
+//struct to hold the statistics of a call to estimate
+struct Motion_Statistics
+{
+	int blocks;				//number of macroblocks
+	int skipped_blocks;		//number of macroblocks given a zero motion vector by the zero motion skip (in both directions for a
+							//bidirectional estimate)
+	bool scene_change;		//true if the frames were found to be a scene change, in which case no macroblock was searched
+	int histogram_difference;	//percentage of the samples in which the histograms of the frames differ
+	int dirty_blocks;		//incremental mode: number of macroblocks which were searched again
+	int carried_blocks;		//incremental mode: number of macroblocks which kept their vector from the previous pair
+	int global_x;			//global motion vector, from which the searches could start
+	int global_y;
+
+	//bidirectional estimate: the statistics above are those of the forward direction (from the previous frame), and
+	//these of the backward direction (from the next frame)
+	bool backward_scene_change;
+	int backward_global_x;
+	int backward_global_y;
+
+	Motion_Statistics() : blocks(0), skipped_blocks(0), scene_change(false), histogram_difference(0), dirty_blocks(0), carried_blocks(0),
+		global_x(0), global_y(0), backward_scene_change(false), backward_global_x(0), backward_global_y(0)
+	{
+	}
+};
+
+//struct to hold the number of finished macroblocks of a macroblock row in a wavefront search, on its own cache line: the
+//struct is sized and aligned to a line, and the counters are held in a jbutil::vector aligned to a line as well
+struct alignas(64) Row_Progress
+{
+	std::atomic<int> blocks;
+};
+typedef jbutil::vector<Row_Progress, 64> Row_Progress_Array;
+
+//struct to hold a frame of a multi-reference search with the data derived from it, computed once when the frame is the
+//current frame and kept while it is a reference frame
+struct Derived_Frame
+{
+	Linear_Frame frame;
+	std::vector<int64_t> column_profile;	//global motion: sums of the samples of every column and of every row
+	std::vector<int64_t> row_profile;
+	std::vector<int> histogram;				//scene change detection: histogram of every 4th sample, 64 bins per channel
+	int histogram_samples;
+
+	Derived_Frame() : histogram_samples(0)
+	{
+	}
+};
+
+//struct to hold a reference frame searched for the macroblocks of the current frame, with the motion field to be set,
+//the motion field of the previous pair searched in the same direction by the object (NULL or of another size if none),
+//from which the incremental mode carries vectors, the global motion vector, and the motion field whose vectors are the
+//temporal predictors and set the adaptive ranges (the field of the previous pair, NULL or of another size if none)
+struct Search_Reference
+{
+	const Linear_Frame* frame;
+	MotionField* field;
+	const MotionField* previous_field;
+	int global_x;
+	int global_y;
+	const MotionField* temporal_field;
+};
+
+//Class used to perform block matching between pairs of frames.
+//Every object holds its own parameters and working buffers, such that different configurations can be used
+//in the same process and objects can be used from different threads. A single object must not be used by
+//more than one thread at a time.
+class MotionEstimator
+{
+public:
+	explicit MotionEstimator(const Motion_Parameters& parameters);
+
+	const Motion_Parameters& get_parameters() const
+	{
+		return parameters;
+	}
+
+	//statistics of the last call to estimate
+	const Motion_Statistics& get_statistics() const
+	{
+		return statistics;
+	}
+
+	//Function used to split the search and the reconstruction of a frame into chunks of macroblock rows, run as tasks
+	//of a scheduler such that idle threads can steal them. With predictors, the rows are searched in wavefront order instead, such that the
+	//motion field is the same as a search on the calling thread. The object must not be used by more than one thread at a time.
+	//Inputs: scheduler (NULL to search on the calling thread only), number of macroblock rows per chunk
+	//Output: None
+	void set_scheduler(Work_Stealing_Scheduler* scheduler, int rows_per_task = 4);
+
+	//Function used to check that the parameters can be used with a frame
+	//Inputs: frame to be checked
+	//Output: True if all parameters are correct, False if not
+	bool check(const jbutil::image<int> &frame) const;
+	//the same for a frame given by its size and the largest value of its samples
+	bool check(int rows, int cols, int range) const;
+
+	//Function used to find the motion vectors of every macroblock of the current frame in the reference frame
+	//Inputs: reference frame, current frame (the frame to be predicted), motion field to be set
+	//Output: None
+	void estimate(const jbutil::image<int> &reference, const jbutil::image<int> &current, MotionField &field);
+	MotionField estimate(const jbutil::image<int> &reference, const jbutil::image<int> &current);
+	//the same, for frames which have already been linearized (eg: a frame used as the current and then the reference frame).
+	//The temporal predictors are the vectors of the last pair given to the object, unless the field of the previous pair
+	//is given: the pairs of a sequence can then be searched by several objects, in any order, with the same result
+	//Inputs: reference frame, current frame, motion field to be set, motion field of the previous pair (NULL to use that of
+	//        the last pair given to the object, empty if none)
+	void estimate(const Linear_Frame &reference, const Linear_Frame &current, MotionField &field, const MotionField* temporal_field = NULL);
+
+	//Function used to find the motion vectors of every macroblock of the current frame in both the previous frame (forward
+	//prediction) and the next frame (backward prediction), in one pass over the macroblocks: every macroblock is packed
+	//once and searched in both frames. Every direction has its own scene change test, global motion and temporal
+	//predictors; the incremental mode is not used.
+	//Inputs: previous frame, current frame, next frame, motion fields to be set for the previous and the next frame
+	//Output: None
+	void estimate(const jbutil::image<int> &previous, const jbutil::image<int> &current, const jbutil::image<int> &next,
+			MotionField &forward_field, MotionField &backward_field);
+	void estimate(const Linear_Frame &previous, const Linear_Frame &current, const Linear_Frame &next,
+			MotionField &forward_field, MotionField &backward_field);
+
+	//Function used to add the next frame of a sequence to a multi-reference search: its macroblocks are searched in the
+	//(up to reference_frames) frames given before it, in one pass over the macroblocks, and every macroblock is given the
+	//vector and reference of the least cost (the newest reference among equal costs). The frames are held in a ring
+	//buffer with the data derived from them, such that nothing is computed again when a frame becomes an older reference.
+	//Every reference has its own scene change test, global motion and temporal predictors; the incremental mode is not used.
+	//Inputs: frame, motion field to be set (with a reference plane)
+	//Output: True if the frame was searched, False if it is the first frame (or its size differs from the references,
+	//        in which case the references are dropped)
+	bool estimate_next(const jbutil::image<int> &frame, MotionField &field);
+	bool estimate_next(const Linear_Frame &frame, MotionField &field);
+
+	//Function used to search a range of macroblock rows of a frame held in windows of rows (strip streaming), the rows
+	//being searched in order from the first one: the field is sized on the first macroblock row, and the motion vectors
+	//are the same as those of estimate once every row is searched. Scene change detection, global motion and the
+	//incremental mode need whole frames and are not used.
+	//Inputs: reference frame holding the rows given by get_strip_margins around the macroblock rows, current frame holding
+	//        the macroblock rows, first and last (exclusive) macroblock row, motion field to be set
+	//Output: None
+	void estimate_rows(const Linear_Frame &reference, const Linear_Frame &current, int row_start, int row_stop, MotionField &field);
+
+	//Function used to get the rows of the reference frame which the search of a macroblock row can read, without global
+	//motion: from margin_above rows above the macroblock row to margin_below rows below it
+	//Inputs: margins to be set, in pixels
+	//Output: None
+	void get_strip_margins(int &margin_above, int &margin_below) const;
+
+	//Function used to get how far the steps of a search can move from its start position, which is one pixel less than
+	//the search range when the range is a power of two (see Search_Steps.h)
+	//Inputs: reach along x and y to be set, in pixels
+	//Output: None
+	void get_search_reach(int &reach_x, int &reach_y) const;
+
+	//Function used to predict the last frame given to estimate_next from the references it was searched in
+	//Inputs: motion field set by estimate_next, frame to be set (must have the same size as the frame)
+	//Output: None
+	void reconstruct_next(const MotionField &field, Linear_Frame &reconstructed) const;
+
+	//Function used to predict a frame from the reference frame and the motion vectors, in chunks of macroblock rows run
+	//by the scheduler if one is set
+	//Inputs: reference frame, motion field, frame to be set (must have the same size as the reference frame)
+	//Output: None
+	void reconstruct(const jbutil::image<int> &reference, const MotionField &field, jbutil::image<int> &reconstructed);
+	jbutil::image<int> reconstruct(const jbutil::image<int> &reference, const MotionField &field);
+	//the same, bi-predicted as the average of the blocks given by the vectors of a bidirectional estimate
+	void reconstruct(const jbutil::image<int> &previous, const jbutil::image<int> &next, const MotionField &forward_field,
+			const MotionField &backward_field, jbutil::image<int> &reconstructed);
+
+private:
+	//Function used to search a range of macroblock rows with the selected engine, returns the number of skipped searches
+	int Search_Rows(const Search_Reference* references, int reference_count, const Linear_Frame &current, int row_start, int row_stop, int* macroblock, Row_Progress* progress);
+	int Search_Frame(const Search_Reference* references, int reference_count, const Linear_Frame &current);
+	int Wavefront_Search(const Search_Reference* references, int reference_count, const Linear_Frame &current);
+	int Three_Step_Search(const Search_Reference* references, int reference_count, const Linear_Frame &frame_2, int row_start, int row_stop, int* macroblock, Row_Progress* progress);
+	void Select_Kernels(int channels);
+	void Derive_Frame(Derived_Frame &data) const;
+	const Derived_Frame& Get_Reference(int reference) const;
+	void Zero_Motion(const Linear_Frame &frame_1, const Linear_Frame &frame_2, MotionField &field);
+	void Hash_Blocks(const Linear_Frame &frame, std::vector<uint64_t> &hashes, std::vector<uint64_t> &previous_hashes);
+	bool Mark_Dirty_Blocks(const Linear_Frame &reference, const MotionField &field);
+	int Get_Macroblock_Size(int channels) const;
+	void Get_Window_Reach(int &reach_x, int &reach_y) const;
+
+	Motion_Parameters parameters;
+	Motion_Statistics statistics;
+
+	//scheduler running the chunks of macroblock rows, if any
+	Work_Stealing_Scheduler* scheduler;
+	int rows_per_task;
+
+	//kernels selected for the block size of the frames being matched, cost kernels of the metric for the macroblocks
+	//(one block, or the search blocks of a step at once) and for the decimated blocks of the pre-screening
+	const Block_Kernels* kernels;
+	Cost_Kernel cost;
+	Batch_Cost_Kernel batch_cost;
+	Cost_Kernel decimated_cost;
+
+	//buffers holding the linearized frames and the packed macroblock (followed by the decimated macroblock with
+	//pre-screening), kept between calls to avoid reallocating them
+	Linear_Frame reference_frame;
+	Linear_Frame current_frame;
+	Linear_Frame next_frame;
+	Linear_Frame reconstructed_frame;
+	jbutil::vector<int> macroblock;
+
+	//motion field of the previous call to estimate, for the temporal predictors and the incremental mode, and the
+	//backward motion field of the previous bidirectional estimate
+	MotionField previous_field;
+	MotionField previous_backward_field;
+
+	//multi-reference search: ring buffer of the last reference_frames+1 frames given to estimate_next (the newest at
+	//newest_frame, frame_count of them held), the fields searched in every reference, and those of the previous frame
+	std::vector<Derived_Frame> frame_ring;
+	int newest_frame;
+	int frame_count;
+	std::vector<MotionField> reference_fields;
+	std::vector<MotionField> previous_reference_fields;
+
+	//strip streaming: number of finished macroblocks of every macroblock row, such that the predictors of a row come
+	//from the rows searched before it
+	Row_Progress_Array strip_progress;
+
+	//incremental mode: hashes of the macroblocks of the frames of the current and the previous pair, and the macroblocks
+	//to be searched (dirty_blocks is NULL when every macroblock is searched)
+	std::vector<uint64_t> current_hashes, previous_current_hashes;
+	std::vector<uint64_t> reference_hashes, previous_reference_hashes;
+	std::vector<unsigned char> dirty;
+	const unsigned char* dirty_blocks;
+};
+
+#endif
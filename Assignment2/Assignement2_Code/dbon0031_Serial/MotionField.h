@@ -0,0 +1,125 @@
+#ifndef __MotionField_h
+#define __MotionField_h
+
+#include "jbutil.h"
+#include <stdint.h>
+
+//Class to hold the motion vectors of all the macroblocks of a frame in structure-of-arrays form:
+//one plane for the x components, one for the y components and an optional plane for the cost (sum of squared
+//errors, or the metric and rate chosen for the search) of every macroblock, and an optional plane for the reference
+//frame of every macroblock in a multi-reference search (0 for the previous frame, 1 for the one before it...). Every plane is 1st index = blocks along x, 2nd index => blocks along y, stored
+//linearly as x+y*blocks_x and aligned (jbutil::vector), such that loops over a plane can be vectorized.
+class MotionField
+{
+public:
+	explicit MotionField(int blocks_x = 0, int blocks_y = 0, bool with_cost = true, bool with_references = false)
+	{
+		resize(blocks_x, blocks_y, with_cost, with_references);
+	}
+
+	void resize(int blocks_x, int blocks_y, bool with_cost = true, bool with_references = false)
+	{
+		this->blocks_x = blocks_x;
+		this->blocks_y = blocks_y;
+		motion_vectors_x.resize(blocks_x*blocks_y);
+		motion_vectors_y.resize(blocks_x*blocks_y);
+		costs.resize(with_cost ? blocks_x*blocks_y : 0);
+		references.resize(with_references ? blocks_x*blocks_y : 0);
+	}
+
+	//number of macroblocks along the x and y directions
+	int get_blocks_x() const
+	{
+		return blocks_x;
+	}
+	int get_blocks_y() const
+	{
+		return blocks_y;
+	}
+	bool has_cost() const
+	{
+		return costs.size() != 0;
+	}
+	bool has_references() const
+	{
+		return references.size() != 0;
+	}
+
+	//data access, x and y are the macroblock co-ordinates (not the pixel co-ordinates)
+	int16_t& motion_vector_x(int x, int y)
+	{
+		assert(x >= 0 && x < blocks_x && y >= 0 && y < blocks_y);
+		return motion_vectors_x[x+y*blocks_x];
+	}
+	int16_t motion_vector_x(int x, int y) const
+	{
+		assert(x >= 0 && x < blocks_x && y >= 0 && y < blocks_y);
+		return motion_vectors_x[x+y*blocks_x];
+	}
+	int16_t& motion_vector_y(int x, int y)
+	{
+		assert(x >= 0 && x < blocks_x && y >= 0 && y < blocks_y);
+		return motion_vectors_y[x+y*blocks_x];
+	}
+	int16_t motion_vector_y(int x, int y) const
+	{
+		assert(x >= 0 && x < blocks_x && y >= 0 && y < blocks_y);
+		return motion_vectors_y[x+y*blocks_x];
+	}
+	uint32_t& cost(int x, int y)
+	{
+		assert(has_cost() && x >= 0 && x < blocks_x && y >= 0 && y < blocks_y);
+		return costs[x+y*blocks_x];
+	}
+	uint32_t cost(int x, int y) const
+	{
+		assert(has_cost() && x >= 0 && x < blocks_x && y >= 0 && y < blocks_y);
+		return costs[x+y*blocks_x];
+	}
+	uint8_t& reference(int x, int y)
+	{
+		assert(has_references() && x >= 0 && x < blocks_x && y >= 0 && y < blocks_y);
+		return references[x+y*blocks_x];
+	}
+	uint8_t reference(int x, int y) const
+	{
+		assert(has_references() && x >= 0 && x < blocks_x && y >= 0 && y < blocks_y);
+		return references[x+y*blocks_x];
+	}
+
+	//whole planes, for loops over all the macroblocks (the cost plane is NULL if there is none)
+	int16_t* motion_vector_x_plane()
+	{
+		return &motion_vectors_x[0];
+	}
+	const int16_t* motion_vector_x_plane() const
+	{
+		return &motion_vectors_x[0];
+	}
+	int16_t* motion_vector_y_plane()
+	{
+		return &motion_vectors_y[0];
+	}
+	const int16_t* motion_vector_y_plane() const
+	{
+		return &motion_vectors_y[0];
+	}
+	uint32_t* cost_plane()
+	{
+		return has_cost() ? &costs[0] : NULL;
+	}
+	const uint32_t* cost_plane() const
+	{
+		return has_cost() ? &costs[0] : NULL;
+	}
+
+private:
+	jbutil::vector<int16_t> motion_vectors_x;
+	jbutil::vector<int16_t> motion_vectors_y;
+	jbutil::vector<uint32_t> costs;
+	jbutil::vector<uint8_t> references;
+	int blocks_x;
+	int blocks_y;
+};
+
+#endif
@@ -0,0 +1,349 @@
+#include "Motion_Compensation.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+//Function pointer for the kernel copying a block of a frame into another frame, a row of row_length integers at a time
+typedef void (*Copy_Kernel)(const int* input, int input_stride, int* output, int output_stride, int row_length, int height);
+
+//the row length is known at compile time, such that the copy of a row is inlined as a few vector moves
+template <int ROW_LENGTH>
+static void Copy_Block_Fixed(const int* input, int input_stride, int* output, int output_stride, int, int height)
+{
+	for (int row = 0; row<height; row++)
+	{
+		std::memcpy(output + row*output_stride, input + row*input_stride, ROW_LENGTH*sizeof(int));
+	}
+}
+
+static void Copy_Block_Generic(const int* input, int input_stride, int* output, int output_stride, int row_length, int height)
+{
+	for (int row = 0; row<height; row++)
+	{
+		std::memcpy(output + row*output_stride, input + row*input_stride, row_length*sizeof(int));
+	}
+}
+
+//Function used to get the copy kernel of a row length: those of the specialized block sizes (4, 8, 16 and 32 pixels
+//with 1 or 3 channels) have a kernel of their own
+//Inputs: number of integers in a row of a block
+//Output: the kernel to be used
+static Copy_Kernel Get_Copy_Kernel(int row_length)
+{
+	switch(row_length)
+	{
+		case 4:		return &Copy_Block_Fixed<4>;
+		case 8:		return &Copy_Block_Fixed<8>;
+		case 12:	return &Copy_Block_Fixed<12>;
+		case 16:	return &Copy_Block_Fixed<16>;
+		case 24:	return &Copy_Block_Fixed<24>;
+		case 32:	return &Copy_Block_Fixed<32>;
+		case 48:	return &Copy_Block_Fixed<48>;
+		case 96:	return &Copy_Block_Fixed<96>;
+		default:	return &Copy_Block_Generic;
+	}
+}
+
+//Function used to get the reference frame of a macroblock
+//Inputs: reference frames, motion field, macroblock co-ordinates
+//Output: the reference frame
+static const Linear_Frame& Get_Reference(const Linear_Frame* const* references, const MotionField &field, int x, int y)
+{
+	return *references[field.has_references() ? field.reference(x, y) : 0];
+}
+
+//Function used to predict a range of macroblock rows by copying the block given by the vector of every macroblock
+//Inputs: reference frames, motion field, macroblock width and height, first and last (exclusive) macroblock row,
+//        linearized frame to be set
+//Output: None
+static void Copy_Rows(const Linear_Frame* const* references, const MotionField &field, int block_width, int block_height,
+		int row_start, int row_stop, Linear_Frame &reconstructed)
+{
+	const int row_length = block_width*reconstructed.channels;
+	const Copy_Kernel copy = Get_Copy_Kernel(row_length);
+
+	for (int y = row_start; y<row_stop; y++)
+	{
+		for (int x = 0; x<field.get_blocks_x(); x++)
+		{
+			const Linear_Frame &reference = Get_Reference(references, field, x, y);
+			int x_start = x*block_width+field.motion_vector_x(x, y);
+			int y_start = y*block_height+field.motion_vector_y(x, y);
+			copy(reference.pixel(y_start, x_start), reference.stride(), reconstructed.pixel(y*block_height, x*block_width), reconstructed.stride(),
+					row_length, block_height);
+		}
+	}
+}
+
+//Function used to predict a range of macroblock rows with OBMC. Every quarter of a macroblock is blended from the
+//blocks given by 4 vectors: that of its macroblock and those of the neighbours on the side of the quarter horizontally,
+//vertically and diagonally (the macroblock itself past the edges of the field). The weight of the horizontal neighbour
+//grows linearly from 0 at the centre of the macroblock to about a half on its edge, and the same vertically, the
+//weights of a pixel being the products of the weights along both axes. The vectors of the neighbours are limited such
+//that the quarter stays in the reference frame.
+//Inputs: reference frames, motion field, macroblock width and height, first and last (exclusive) macroblock row,
+//        linearized frame to be set
+//Output: None
+static void Overlapped_Rows(const Linear_Frame* const* references, const MotionField &field, int block_width, int block_height,
+		int row_start, int row_stop, Linear_Frame &reconstructed)
+{
+	const int channels = reconstructed.channels;
+	const int denominator_x = 2*block_width;
+	const int denominator_y = 2*block_height;
+	const int denominator = denominator_x*denominator_y;
+
+	for (int y = row_start; y<row_stop; y++)
+	{
+		for (int x = 0; x<field.get_blocks_x(); x++)
+		{
+			for (int quarter = 0; quarter<4; quarter++)
+			{
+				//the quarter: left or right half of the columns, top or bottom half of the rows
+				const int side_x = quarter & 1;
+				const int side_y = quarter >> 1;
+				const int col_start = side_x ? block_width/2 : 0;
+				const int col_stop = side_x ? block_width : block_width/2;
+				const int row_first = side_y ? block_height/2 : 0;
+				const int row_last = side_y ? block_height : block_height/2;
+				if((col_start == col_stop) || (row_first == row_last))
+				{
+					continue;
+				}
+				const int pixel_x = x*block_width+col_start;
+				const int pixel_y = y*block_height+row_first;
+
+				//the blocks of the macroblock, and of its horizontal, vertical and diagonal neighbours
+				const int neighbour_x = std::min(std::max(x + (side_x ? 1 : -1), 0), field.get_blocks_x()-1);
+				const int neighbour_y = std::min(std::max(y + (side_y ? 1 : -1), 0), field.get_blocks_y()-1);
+				const int blocks_x[4] = {x, neighbour_x, x, neighbour_x};
+				const int blocks_y[4] = {y, y, neighbour_y, neighbour_y};
+				const int* sources[4];
+				int source_strides[4];
+				for (int block = 0; block<4; block++)
+				{
+					const Linear_Frame &reference = Get_Reference(references, field, blocks_x[block], blocks_y[block]);
+					int source_x = std::min(std::max(pixel_x + field.motion_vector_x(blocks_x[block], blocks_y[block]), 0), reference.cols-(col_stop-col_start));
+					int source_y = std::min(std::max(pixel_y + field.motion_vector_y(blocks_x[block], blocks_y[block]), 0), reference.rows-(row_last-row_first));
+					sources[block] = reference.pixel(source_y, source_x);
+					source_strides[block] = reference.stride();
+				}
+
+				for (int row = row_first; row<row_last; row++)
+				{
+					const int weight_y = std::abs(2*row+1-block_height);
+					int* output = reconstructed.pixel(y*block_height+row, pixel_x);
+					const int source_row = row-row_first;
+					for (int col = col_start; col<col_stop; col++)
+					{
+						const int weight_x = std::abs(2*col+1-block_width);
+						const int weights[4] = {(denominator_x-weight_x)*(denominator_y-weight_y), weight_x*(denominator_y-weight_y),
+								(denominator_x-weight_x)*weight_y, weight_x*weight_y};
+						const int offset = (col-col_start)*channels;
+						for (int channel = 0; channel<channels; channel++)
+						{
+							int sum = denominator/2;
+							for (int block = 0; block<4; block++)
+							{
+								sum = sum + weights[block]*sources[block][source_row*source_strides[block] + offset + channel];
+							}
+							output[offset + channel] = sum/denominator;
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+//Function used to bi-predict a range of macroblock rows
+//Inputs: previous and next frames, forward and backward motion fields, macroblock width and height, first and last
+//        (exclusive) macroblock row, linearized frame to be set
+//Output: None
+static void Bidirectional_Rows(const Linear_Frame &previous, const Linear_Frame &next, const MotionField &forward_field, const MotionField &backward_field,
+		int block_width, int block_height, int row_start, int row_stop, Linear_Frame &reconstructed)
+{
+	const int row_length = block_width*previous.channels;
+	for (int y = row_start; y<row_stop; y++)
+	{
+		for (int x = 0; x<forward_field.get_blocks_x(); x++)
+		{
+			//the average of the block predicted from the previous frame and of the block predicted from the next frame
+			const int* forward = previous.pixel(y*block_height+forward_field.motion_vector_y(x, y), x*block_width+forward_field.motion_vector_x(x, y));
+			const int* backward = next.pixel(y*block_height+backward_field.motion_vector_y(x, y), x*block_width+backward_field.motion_vector_x(x, y));
+			int* output = reconstructed.pixel(y*block_height, x*block_width);
+			for (int row = 0; row<block_height; row++)
+			{
+				const int* forward_row = forward + row*previous.stride();
+				const int* backward_row = backward + row*next.stride();
+				int* output_row = output + row*reconstructed.stride();
+				for (int i = 0; i<row_length; i++)
+				{
+					output_row[i] = (forward_row[i] + backward_row[i] + 1) >> 1;
+				}
+			}
+		}
+	}
+}
+
+//Function used to predict a range of macroblock rows of an image, a row of a block of a channel at a time, the rows of
+//a channel being contiguous in an image. The specialized block widths (WIDTH, 0 for any other width) copy a row of a
+//block inline.
+//Inputs: reference image, motion field, macroblock width and height, first and last (exclusive) macroblock row, image
+//        to be set
+//Output: None
+template <int WIDTH>
+static void Copy_Image_Rows(const jbutil::image<int> &reference, const MotionField &field, int block_width, int block_height,
+		int row_start, int row_stop, jbutil::image<int> &reconstructed)
+{
+	const int width = (WIDTH != 0) ? WIDTH : block_width;
+	for (int y = row_start; y<row_stop; y++)
+	{
+		for (int channel = 0; channel<reconstructed.channels(); channel++)
+		{
+			for (int row = y*block_height; row<(y+1)*block_height; row++)
+			{
+				int* output = &reconstructed(channel, row, 0);
+				for (int x = 0; x<field.get_blocks_x(); x++)
+				{
+					std::memcpy(output + x*width, &reference(channel, row+field.motion_vector_y(x, y), x*width+field.motion_vector_x(x, y)), width*sizeof(int));
+				}
+			}
+		}
+	}
+}
+
+//Function used to bi-predict a range of macroblock rows of an image
+//Inputs: previous and next images, forward and backward motion fields, macroblock width and height, first and last
+//        (exclusive) macroblock row, image to be set
+//Output: None
+static void Bidirectional_Image_Rows(const jbutil::image<int> &previous, const jbutil::image<int> &next, const MotionField &forward_field,
+		const MotionField &backward_field, int block_width, int block_height, int row_start, int row_stop, jbutil::image<int> &reconstructed)
+{
+	for (int y = row_start; y<row_stop; y++)
+	{
+		for (int channel = 0; channel<reconstructed.channels(); channel++)
+		{
+			for (int row = y*block_height; row<(y+1)*block_height; row++)
+			{
+				int* output = &reconstructed(channel, row, 0);
+				for (int x = 0; x<forward_field.get_blocks_x(); x++)
+				{
+					const int* forward = &previous(channel, row+forward_field.motion_vector_y(x, y), x*block_width+forward_field.motion_vector_x(x, y));
+					const int* backward = &next(channel, row+backward_field.motion_vector_y(x, y), x*block_width+backward_field.motion_vector_x(x, y));
+					int* output_block = output + x*block_width;
+					for (int i = 0; i<block_width; i++)
+					{
+						output_block[i] = (forward[i] + backward[i] + 1) >> 1;
+					}
+				}
+			}
+		}
+	}
+}
+
+//Function used to run a function over the macroblock rows of a frame, in chunks run by a scheduler if there is one
+//Inputs: number of macroblock rows, scheduler (NULL if none), macroblock rows per task, function predicting a range of
+//        macroblock rows (first and last, exclusive)
+//Output: None
+template <typename Predict_Rows>
+static void Run_Rows(int blocks_y, Work_Stealing_Scheduler* scheduler, int rows_per_task, const Predict_Rows &predict_rows)
+{
+	if((scheduler == NULL) || (blocks_y <= rows_per_task))
+	{
+		predict_rows(0, blocks_y);
+		return;
+	}
+
+	//the chunks set separate rows of the frame, and only read the reference frames
+	Task_Group chunks;
+	for (int row_start = 0; row_start<blocks_y; row_start = row_start+rows_per_task)
+	{
+		int row_stop = (row_start+rows_per_task < blocks_y) ? row_start+rows_per_task : blocks_y;
+		scheduler->Submit(chunks, [&predict_rows, row_start, row_stop]()
+		{
+			TRACE_SCOPE_ARG("Compensate Rows", row_start);
+			predict_rows(row_start, row_stop);
+		});
+	}
+	scheduler->Wait(chunks);
+}
+
+//Function used to write the pixel rows of a range of macroblock rows to an image, and the rows past the last whole
+//macroblock row with the last range
+//Inputs: linearized frame, first and last (exclusive) macroblock row, number of macroblock rows, macroblock height,
+//        image to be set (NULL if none)
+//Output: None
+static void Write_Rows(const Linear_Frame &reconstructed, int row_start, int row_stop, int blocks_y, int block_height, jbutil::image<int>* image)
+{
+	if(image != NULL)
+	{
+		Delinearize_Rows(reconstructed, row_start*block_height, (row_stop == blocks_y) ? reconstructed.rows : row_stop*block_height, *image);
+	}
+}
+
+void Compensate_Frame(const Linear_Frame* const* references, const MotionField &field, int block_width, int block_height, bool overlapped,
+		Work_Stealing_Scheduler* scheduler, int rows_per_task, Linear_Frame &reconstructed, jbutil::image<int>* image)
+{
+	Run_Rows(field.get_blocks_y(), scheduler, rows_per_task, [&](int row_start, int row_stop)
+	{
+		Compensate_Macroblock_Rows(references, field, block_width, block_height, overlapped, row_start, row_stop, reconstructed);
+		Write_Rows(reconstructed, row_start, row_stop, field.get_blocks_y(), block_height, image);
+	});
+}
+
+void Compensate_Macroblock_Rows(const Linear_Frame* const* references, const MotionField &field, int block_width, int block_height, bool overlapped,
+		int row_start, int row_stop, Linear_Frame &reconstructed)
+{
+	if(overlapped)
+	{
+		Overlapped_Rows(references, field, block_width, block_height, row_start, row_stop, reconstructed);
+	}
+	else
+	{
+		Copy_Rows(references, field, block_width, block_height, row_start, row_stop, reconstructed);
+	}
+}
+
+void Compensate_Image(const jbutil::image<int> &reference, const MotionField &field, int block_width, int block_height,
+		Work_Stealing_Scheduler* scheduler, int rows_per_task, jbutil::image<int> &reconstructed)
+{
+	Run_Rows(field.get_blocks_y(), scheduler, rows_per_task, [&](int row_start, int row_stop)
+	{
+		switch(block_width)
+		{
+			case 4:		Copy_Image_Rows<4>(reference, field, block_width, block_height, row_start, row_stop, reconstructed);		break;
+			case 8:		Copy_Image_Rows<8>(reference, field, block_width, block_height, row_start, row_stop, reconstructed);		break;
+			case 16:	Copy_Image_Rows<16>(reference, field, block_width, block_height, row_start, row_stop, reconstructed);	break;
+			case 32:	Copy_Image_Rows<32>(reference, field, block_width, block_height, row_start, row_stop, reconstructed);	break;
+			default:	Copy_Image_Rows<0>(reference, field, block_width, block_height, row_start, row_stop, reconstructed);		break;
+		}
+	});
+}
+
+void Compensate_Bidirectional_Image(const jbutil::image<int> &previous, const jbutil::image<int> &next, const MotionField &forward_field,
+		const MotionField &backward_field, int block_width, int block_height, Work_Stealing_Scheduler* scheduler, int rows_per_task,
+		jbutil::image<int> &reconstructed)
+{
+	Run_Rows(forward_field.get_blocks_y(), scheduler, rows_per_task, [&](int row_start, int row_stop)
+	{
+		Bidirectional_Image_Rows(previous, next, forward_field, backward_field, block_width, block_height, row_start, row_stop, reconstructed);
+	});
+}
+
+void Reconstruct_Frame(const Linear_Frame &reference, const MotionField &field, int block_width, int block_height, Linear_Frame &reconstructed)
+{
+	const Linear_Frame* references[1] = {&reference};
+	Copy_Rows(references, field, block_width, block_height, 0, field.get_blocks_y(), reconstructed);
+}
+
+void Reconstruct_Frame(const Linear_Frame* const* references, const MotionField &field, int block_width, int block_height, Linear_Frame &reconstructed)
+{
+	Copy_Rows(references, field, block_width, block_height, 0, field.get_blocks_y(), reconstructed);
+}
+
+void Reconstruct_Bidirectional(const Linear_Frame &previous, const Linear_Frame &next, const MotionField &forward_field, const MotionField &backward_field,
+		int block_width, int block_height, Linear_Frame &reconstructed)
+{
+	Bidirectional_Rows(previous, next, forward_field, backward_field, block_width, block_height, 0, forward_field.get_blocks_y(), reconstructed);
+}
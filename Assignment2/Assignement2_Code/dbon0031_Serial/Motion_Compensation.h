@@ -0,0 +1,66 @@
+#ifndef __Motion_Compensation_h
+#define __Motion_Compensation_h
+
+#include "jbutil.h"
+#include "Block_Kernels.h"
+#include "MotionField.h"
+#include "Scheduler.h"
+
+//Motion compensation: the prediction of a frame from its reference frames and motion field. Every macroblock row of
+//the prediction is set from the blocks its vectors point to, a row of a block at a time (a copy of a known length for
+//the specialized sizes, or an average for bi-prediction which the compiler vectorizes). With a scheduler, the
+//macroblock rows are split into chunks run as tasks, and every chunk writes its rows to the output image as soon as
+//they are set, while they are still in the cache. Images can also be predicted without being linearized, the rows of
+//the blocks being copied within every channel plane, which saves a pass over the reference and the predicted frames.
+//With overlapped block motion compensation (OBMC), every pixel is a bilinear blend of the blocks given by the vector of
+//its macroblock and by the vectors of the neighbours nearest to it (horizontal, vertical and diagonal), such that the
+//prediction has no edges at the macroblock boundaries: at the centre of a macroblock only its own vector is used, and
+//on a boundary the vectors of both sides have the same weight.
+
+//Function used to predict a frame from its reference frames
+//Inputs: linearized reference frames (indexed by the reference plane of the field, only the first one if it has
+//        none), motion field, macroblock width and height, true for OBMC, scheduler (NULL if none), macroblock rows per
+//        task, linearized frame to be set, image to be set with the prediction as well (NULL if none)
+//Output: None
+void Compensate_Frame(const Linear_Frame* const* references, const MotionField &field, int block_width, int block_height, bool overlapped,
+		Work_Stealing_Scheduler* scheduler, int rows_per_task, Linear_Frame &reconstructed, jbutil::image<int>* image);
+
+//the same for a range of macroblock rows, with frames which may hold a window of their rows only (strip streaming):
+//the references must hold the rows the vectors point to (and with OBMC those the vectors of the neighbours point to)
+//Inputs: linearized reference frames, motion field, macroblock width and height, true for OBMC, first and last
+//        (exclusive) macroblock row, linearized frame to be set
+void Compensate_Macroblock_Rows(const Linear_Frame* const* references, const MotionField &field, int block_width, int block_height, bool overlapped,
+		int row_start, int row_stop, Linear_Frame &reconstructed);
+
+//Function used to predict an image from a reference image, without linearizing them (OBMC is not available)
+//Inputs: reference image, motion field, macroblock width and height, scheduler (NULL if none), macroblock rows per
+//        task, image to be set (of the same size as the reference image)
+//Output: None
+void Compensate_Image(const jbutil::image<int> &reference, const MotionField &field, int block_width, int block_height,
+		Work_Stealing_Scheduler* scheduler, int rows_per_task, jbutil::image<int> &reconstructed);
+
+//the same, bi-predicted from the previous and the next images
+//Inputs: previous and next images, forward and backward motion fields, macroblock width and height, scheduler (NULL if
+//        none), macroblock rows per task, image to be set
+void Compensate_Bidirectional_Image(const jbutil::image<int> &previous, const jbutil::image<int> &next, const MotionField &forward_field,
+		const MotionField &backward_field, int block_width, int block_height, Work_Stealing_Scheduler* scheduler, int rows_per_task,
+		jbutil::image<int> &reconstructed);
+
+//Function used to reconstruct a frame from a reference frame given the motion vectors of every macroblock
+//Inputs: linearized reference frame, motion field, macroblock width and height, linearized frame to be set
+//Output: None
+void Reconstruct_Frame(const Linear_Frame &reference, const MotionField &field, int block_width, int block_height, Linear_Frame &reconstructed);
+
+//the same for a multi-reference search, every macroblock being taken from its own reference frame
+//Inputs: linearized reference frames (0 for the previous frame), motion field with a reference plane, macroblock width
+//        and height, linearized frame to be set
+void Reconstruct_Frame(const Linear_Frame* const* references, const MotionField &field, int block_width, int block_height, Linear_Frame &reconstructed);
+
+//Function used to bi-predict a frame as the average of the blocks given by the vectors of a bidirectional estimate
+//Inputs: linearized previous and next frames, forward and backward motion fields, macroblock width and height,
+//        linearized frame to be set
+//Output: None
+void Reconstruct_Bidirectional(const Linear_Frame &previous, const Linear_Frame &next, const MotionField &forward_field, const MotionField &backward_field,
+		int block_width, int block_height, Linear_Frame &reconstructed);
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef __Pipeline_h
+#define __Pipeline_h
+
+#include "Trace.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <stddef.h>
+
+//Bounded lock-free queue with any number of producers and consumers (the array-based queue by D. Vyukov).
+//Every cell holds a sequence number which tells whether it is free for the push, or full for the pop, of a
+//given position, so pushes and pops only need a compare-and-swap on their position counter.
+//Push waits while the queue is full and Pop waits while it is empty, yielding the processor; once the queue
+//is closed by its producers, Pop returns false when it is empty.
+template <class T>
+class Bounded_Queue
+{
+public:
+	//the capacity is rounded up to a power of 2
+	explicit Bounded_Queue(size_t capacity) : closed(false), push_position(0), pop_position(0)
+	{
+		size_t size = 2;
+		while(size < capacity)
+		{
+			size = size*2;
+		}
+		cells = std::vector<Cell>(size);
+		mask = size-1;
+		for (size_t cell = 0; cell<size; cell++)
+		{
+			cells[cell].sequence.store(cell, std::memory_order_relaxed);
+		}
+	}
+
+	//Function used to add an item, waiting while the queue is full
+	//Inputs: item to be added
+	//Output: None
+	void Push(const T &item)
+	{
+		while(!Try_Push(item))
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	//Function used to remove the oldest item, waiting while the queue is empty
+	//Inputs: item to be set
+	//Output: True if an item was removed, False if the queue is empty and closed
+	bool Pop(T &item)
+	{
+		while(!Try_Pop(item))
+		{
+			if(closed.load(std::memory_order_acquire))
+			{
+				//an item pushed just before closing must still be returned
+				return Try_Pop(item);
+			}
+			std::this_thread::yield();
+		}
+		return true;
+	}
+
+	//Function used by the producers once they are done, to release the waiting consumers
+	void Close()
+	{
+		closed.store(true, std::memory_order_release);
+	}
+
+	bool Try_Push(const T &item)
+	{
+		size_t position = push_position.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell &cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			ptrdiff_t difference = ptrdiff_t(sequence) - ptrdiff_t(position);
+			if(difference == 0)
+			{
+				if(push_position.compare_exchange_weak(position, position+1, std::memory_order_relaxed))
+				{
+					cell.item = item;
+					cell.sequence.store(position+1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if(difference < 0)
+			{
+				return false;		//full
+			}
+			else
+			{
+				position = push_position.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool Try_Pop(T &item)
+	{
+		size_t position = pop_position.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell &cell = cells[position & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			ptrdiff_t difference = ptrdiff_t(sequence) - ptrdiff_t(position+1);
+			if(difference == 0)
+			{
+				if(pop_position.compare_exchange_weak(position, position+1, std::memory_order_relaxed))
+				{
+					item = cell.item;
+					cell.item = T();
+					cell.sequence.store(position+mask+1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if(difference < 0)
+			{
+				return false;		//empty
+			}
+			else
+			{
+				position = pop_position.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T item;
+
+		Cell() : sequence(0)
+		{
+		}
+		Cell(const Cell &other) : sequence(other.sequence.load()), item(other.item)
+		{
+		}
+	};
+
+	std::vector<Cell> cells;
+	size_t mask;
+	std::atomic<bool> closed;
+
+	//the push and pop positions are written by different threads, so they are kept on different cache lines
+	char padding_1[64];
+	std::atomic<size_t> push_position;
+	char padding_2[64];
+	std::atomic<size_t> pop_position;
+	char padding_3[64];
+};
+
+//Function used to start the workers of a pipeline stage. Every worker pops items from the input queue and
+//passes them to the stage function until the queue is closed and empty; the last worker to finish closes
+//the output queue, such that the next stage stops once it has processed everything.
+//Inputs: name of the stage (for the trace), number of workers, input and output queues (output can be NULL
+//        for the last stage), stage function (worker index, item, output queue) and the list where the threads are added
+//Output: None
+template <class In, class Out>
+void Start_Stage(const std::string &name, int workers, Bounded_Queue<In> &input, Bounded_Queue<Out>* output,
+		std::function<void(int, In&, Bounded_Queue<Out>*)> function, std::vector<std::thread> &threads)
+{
+	std::shared_ptr<std::atomic<int> > running(new std::atomic<int>(workers));
+	for (int worker = 0; worker<workers; worker++)
+	{
+		threads.push_back(std::thread([name, worker, running, &input, output, function]()
+		{
+			if(Trace_Recorder::Instance().Enabled())
+			{
+				Trace_Recorder::Instance().Name_Thread(name);
+			}
+
+			In item;
+			while(input.Pop(item))
+			{
+				function(worker, item, output);
+				//the item is not kept while waiting for the next one
+				item = In();
+			}
+			if((running->fetch_sub(1) == 1) && (output != NULL))
+			{
+				output->Close();
+			}
+		}));
+	}
+}
+
+#endif
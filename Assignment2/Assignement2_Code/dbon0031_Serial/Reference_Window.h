@@ -0,0 +1,110 @@
+#ifndef __Reference_Window_h
+#define __Reference_Window_h
+
+#include "Block_Kernels.h"
+#include <cstring>
+
+//Class used to read the search blocks of a macroblock row from the reference frame.
+//In sliding mode, the search windows of the macroblocks of a row are copied into a small buffer which keeps the columns
+//shared by horizontally adjacent windows: moving to the next macroblock only copies the newly exposed columns, such that
+//every pixel of the strip is read from the frame once per macroblock row (data reuse "Level C"). The buffer is twice the
+//width of a window, and the kept columns are moved back to its start when the window reaches its end.
+//In direct mode, the blocks are read from the frame itself.
+class Reference_Window
+{
+public:
+	//Inputs: reference frame, true for sliding mode, largest window height and width (in pixels) to be requested
+	Reference_Window(const Linear_Frame &frame, bool sliding, int height, int width) :
+		frame(frame), sliding(sliding), row_start(0), row_count(0), col_start(0), col_stop(0)
+	{
+		if(sliding)
+		{
+			capacity = 2*width;
+			data.resize(height*capacity*frame.channels);
+		}
+		else
+		{
+			capacity = frame.cols;
+		}
+	}
+
+	//Function used to start a new macroblock row, whose windows span the frame rows from row_start to row_stop (exclusive)
+	void set_rows(int row_start, int row_stop)
+	{
+		this->row_start = row_start;
+		row_count = row_stop-row_start;
+		col_start = 0;
+		col_stop = 0;
+		assert(!sliding || (row_count*capacity*frame.channels <= data.size()));
+	}
+
+	//Function used to make the columns of a window available, from col_start to col_stop (exclusive). The windows of a
+	//row must be requested from left to right.
+	void set_columns(int col_start, int col_stop)
+	{
+		if(!sliding)
+		{
+			return;
+		}
+		assert(col_stop-col_start <= capacity/2);
+
+		const int channels = frame.channels;
+		if((col_start >= this->col_stop) || (col_start < this->col_start))
+		{
+			//nothing to keep
+			this->col_start = col_start;
+			this->col_stop = col_start;
+		}
+		else if(col_stop > this->col_start+capacity)
+		{
+			//move the columns which are kept to the start of the buffer
+			const int kept = this->col_stop-col_start;
+			for (int row = 0; row<row_count; row++)
+			{
+				int* buffer_row = &data[row*capacity*channels];
+				std::memmove(buffer_row, buffer_row + (col_start-this->col_start)*channels, kept*channels*sizeof(int));
+			}
+			this->col_start = col_start;
+		}
+
+		//copy the newly exposed columns
+		if(col_stop > this->col_stop)
+		{
+			const int count = (col_stop-this->col_stop)*channels;
+			for (int row = 0; row<row_count; row++)
+			{
+				std::memcpy(&data[(row*capacity + (this->col_stop-this->col_start))*channels], frame.pixel(row_start+row, this->col_stop), count*sizeof(int));
+			}
+			this->col_stop = col_stop;
+		}
+	}
+
+	//pointer to the first channel of a pixel, given by its frame co-ordinates
+	const int* pixel(int row, int col) const
+	{
+		if(!sliding)
+		{
+			return frame.pixel(row, col);
+		}
+		assert(row >= row_start && row < row_start+row_count && col >= col_start && col < col_stop);
+		return &data[((row-row_start)*capacity + (col-col_start))*frame.channels];
+	}
+
+	//number of integers between vertically adjacent pixels
+	int stride() const
+	{
+		return capacity*frame.channels;
+	}
+
+private:
+	const Linear_Frame &frame;
+	bool sliding;
+	int capacity;				//number of columns of the buffer (of the frame in direct mode)
+	jbutil::vector<int> data;
+
+	//frame rows and columns held in the buffer
+	int row_start, row_count;
+	int col_start, col_stop;
+};
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef __Scheduler_h
+#define __Scheduler_h
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+
+//Class used to count the tasks of a group which have not finished yet, such that they can be waited for
+class Task_Group
+{
+public:
+	Task_Group() : pending(0)
+	{
+	}
+
+private:
+	friend class Work_Stealing_Scheduler;
+	std::atomic<int> pending;
+};
+
+//Work stealing scheduler: every thread has its own queue of tasks, takes the newest task of its own queue and,
+//once that is empty, steals the oldest task of another queue. Tasks can submit tasks themselves (eg: a frame pair
+//splitting its macroblock rows into chunks), which are put on the queue of the thread running them, such that
+//a thread which runs out of work takes over part of a long task instead of being idle until the end of a batch.
+//A thread waiting for a group runs tasks in the meantime, so waiting from inside a task does not block a thread.
+class Work_Stealing_Scheduler
+{
+public:
+	//threads is the total number of threads, including the thread which waits for the tasks (0 for one per core)
+	explicit Work_Stealing_Scheduler(int threads = 0) : stopping(false), queued(0)
+	{
+		if(threads <= 0)
+		{
+			threads = std::thread::hardware_concurrency();
+		}
+		if(threads <= 0)
+		{
+			threads = 1;
+		}
+
+		//queue 0 is used by the threads which do not belong to the scheduler
+		for (int thread = 0; thread<threads; thread++)
+		{
+			queues.push_back(std::unique_ptr<Task_Queue>(new Task_Queue));
+		}
+		for (int thread = 1; thread<threads; thread++)
+		{
+			workers.push_back(std::thread(&Work_Stealing_Scheduler::Worker, this, thread));
+		}
+	}
+
+	~Work_Stealing_Scheduler()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (size_t thread = 0; thread<workers.size(); thread++)
+		{
+			workers[thread].join();
+		}
+	}
+
+	int get_threads() const
+	{
+		return int(queues.size());
+	}
+
+	//Function used to add a task to a group
+	//Inputs: group of the task, function to be run
+	//Output: None
+	void Submit(Task_Group &group, const std::function<void()> &function)
+	{
+		group.pending.fetch_add(1);
+		Task task = {function, &group};
+		{
+			Task_Queue &queue = *queues[Queue_Index()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.tasks.push_back(task);
+		}
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+			queued.fetch_add(1);
+		}
+		wake.notify_one();
+	}
+
+	//Function used to wait until all the tasks of a group are finished, running any available task meanwhile
+	//Inputs: group to be waited for
+	//Output: None
+	void Wait(Task_Group &group)
+	{
+		const int index = Queue_Index();
+		while(group.pending.load() > 0)
+		{
+			Task task;
+			if(Find_Task(index, task))
+			{
+				Run(task);
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+private:
+	struct Task
+	{
+		std::function<void()> function;
+		Task_Group* group;
+	};
+
+	//the queues are padded such that each one is on its own cache lines, as it is written by its owner and by
+	//the threads stealing from it
+	struct Task_Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+		char padding[64];
+	};
+
+	//Function used to get the queue of the calling thread (0 if it is not a thread of this scheduler)
+	int Queue_Index()
+	{
+		const Work_Stealing_Scheduler* &owner = This_Thread_Owner();
+		return (owner == this) ? This_Thread_Index() : 0;
+	}
+	static const Work_Stealing_Scheduler*& This_Thread_Owner()
+	{
+		static thread_local const Work_Stealing_Scheduler* owner = NULL;
+		return owner;
+	}
+	static int& This_Thread_Index()
+	{
+		static thread_local int index = 0;
+		return index;
+	}
+
+	//Function used to take a task: the newest of the given queue, else the oldest of the first other queue with tasks
+	//Inputs: queue of the calling thread, task to be set
+	//Output: True if a task was found, False if not
+	bool Find_Task(int index, Task &task)
+	{
+		const int threads = int(queues.size());
+		for (int offset = 0; offset<threads; offset++)
+		{
+			Task_Queue &queue = *queues[(index+offset)%threads];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if(!queue.tasks.empty())
+			{
+				if(offset == 0)
+				{
+					task = queue.tasks.back();
+					queue.tasks.pop_back();
+				}
+				else
+				{
+					task = queue.tasks.front();
+					queue.tasks.pop_front();
+				}
+				queued.fetch_sub(1);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Run(Task &task)
+	{
+		task.function();
+		task.group->pending.fetch_sub(1);
+	}
+
+	void Worker(int index)
+	{
+		This_Thread_Owner() = this;
+		This_Thread_Index() = index;
+
+		while(!stopping)
+		{
+			Task task;
+			if(Find_Task(index, task))
+			{
+				Run(task);
+			}
+			else
+			{
+				std::unique_lock<std::mutex> lock(sleep_mutex);
+				wake.wait(lock, [this]() { return stopping || (queued.load() > 0); });
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<Task_Queue> > queues;
+	std::vector<std::thread> workers;
+
+	//the workers sleep while there are no queued tasks
+	std::atomic<bool> stopping;
+	std::atomic<int> queued;
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef __Search_Steps_h
+#define __Search_Steps_h
+
+//The step schedule of the logarithmic search: a search range of R pixels is covered in ceil(log2(R)) steps, the
+//distance of step k being ceil(R/2^(k+1)), such that the distance is halved at every step down to 1 pixel and the steps
+//add up to about R. A range of 8 gives the distances 4, 2, 1 of the three step search, a range of 32 gives 16, 8, 4, 2, 1.
+//The reach of the search (the sum of the distances) is R-1 when R is a power of two, and at least R otherwise: the range
+//is rounded down to the reach of its steps rather than given an extra step, such that a range of 8 remains the three
+//step search, which reaches 7 pixels. A range of 2 is a single step of 1 pixel, and a range of 4 reaches 3 pixels.
+//Debug builds of the programs report the reach when it is shorter than the range asked for.
+//The functions are constexpr, such that the schedule of a range known at compile time is computed by the compiler.
+
+//Function used to get the number of steps needed to cover a search range (at least 1)
+//Inputs: search range, in pixels (at least 1)
+//Output: the number of steps
+constexpr int Get_Step_Count(int search_range)
+{
+	return (search_range <= 2) ? 1 : 1 + Get_Step_Count((search_range+1)/2);
+}
+
+//Function used to get the number of steps of a search with different ranges along x and y
+//Inputs: search ranges along x and y
+//Output: the number of steps, such that the larger range is covered
+constexpr int Get_Step_Count(int search_range_x, int search_range_y)
+{
+	return (Get_Step_Count(search_range_x) > Get_Step_Count(search_range_y)) ? Get_Step_Count(search_range_x) : Get_Step_Count(search_range_y);
+}
+
+//Function used to get the distance of a step, which is 1 for the steps past those needed by the range
+//Inputs: search range, index of the step (from 0)
+//Output: the step distance in pixels
+constexpr int Get_Step_Distance(int search_range, int step)
+{
+	return (search_range + (2 << step) - 1)/(2 << step);
+}
+
+//Function used to get how far the steps of a search can move from the start position: the sum of the step distances
+//Inputs: search range, number of steps (at least those of the range)
+//Output: the distance in pixels
+constexpr int Get_Search_Reach(int search_range, int steps)
+{
+	return (steps == 0) ? 0 : Get_Step_Distance(search_range, steps-1) + Get_Search_Reach(search_range, steps-1);
+}
+
+//The 9 search blocks of a step, in units of the step distance, in the order in which they are tested
+constexpr int STEP_PATTERN_X[9] = {-1, -1, -1, 0, 0, 0, 1, 1, 1};
+constexpr int STEP_PATTERN_Y[9] = {-1, 0, 1, -1, 0, 1, -1, 0, 1};
+
+static_assert(Get_Step_Count(8) == 3 && Get_Step_Distance(8, 0) == 4 && Get_Step_Distance(8, 2) == 1, "A range of 8 must give the three step search");
+static_assert(Get_Step_Count(32) == 5 && Get_Search_Reach(32, 5) == 31, "A range of 32 must be covered in 5 steps");
+static_assert(Get_Search_Reach(2, Get_Step_Count(2)) == 1 && Get_Search_Reach(4, Get_Step_Count(4)) == 3, "A range which is a power of two is rounded down");
+
+#endif
@@ -0,0 +1,446 @@
+#include "Sequence.h"
+#include "Pipeline.h"
+#include "Scheduler.h"
+#include "Trace.h"
+#include <future>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <atomic>
+#include <sstream>
+#include <cmath>
+
+typedef std::shared_ptr<const Linear_Frame> Frame_Pointer;
+typedef std::shared_ptr<const MotionField> Field_Pointer;
+
+//struct to hold a frame while it goes through the pipeline. The number of frames in the pipeline is counted
+//from the moment a frame is given to the load stage until its job is destroyed (written, or dropped on error).
+struct Sequence_Job
+{
+	int index;
+	bool failed;
+	jbutil::image<int> image;			//the loaded frame, then the reconstructed frame
+	Frame_Pointer frame;				//the linearized frame
+	Frame_Pointer reference;			//the linearized frame before it
+	MotionField field;
+	Motion_Statistics statistics;
+	std::atomic<int>* in_flight;
+
+	Sequence_Job(int index, std::atomic<int>* in_flight) : index(index), failed(false), in_flight(in_flight)
+	{
+	}
+	~Sequence_Job()
+	{
+		in_flight->fetch_sub(1);
+	}
+};
+
+typedef std::shared_ptr<Sequence_Job> Job_Pointer;
+
+//Function used to get the path of a frame of the sequence
+//Inputs: path of the frames, file name before the index, frame index
+//Output: path of the file
+static std::string Frame_Path(const std::string &path, const char* name, int index)
+{
+	std::ostringstream file_path;
+	file_path << path << "/" << name << index << ".ppm";
+	return file_path.str();
+}
+
+double PSNR(const Linear_Frame &frame, const Linear_Frame &reconstructed)
+{
+	uint64_t SSE = 0;
+	for (int i = 0; i<frame.data.size(); i++)
+	{
+		int difference = frame.data[i] - reconstructed.data[i];
+		SSE = SSE + uint64_t(difference*difference);
+	}
+	if(SSE == 0)
+	{
+		return INFINITY;
+	}
+	double MSE = double(SSE)/double(frame.data.size());
+	return 10.0*std::log10(255.0*255.0/MSE);
+}
+
+//Function used to set the result of a predicted frame
+//Inputs: index of the frame, linearized frame, its reconstruction, its motion field and search statistics, result to be set
+//Output: None
+static void Set_Result(int index, const Linear_Frame &frame, const Linear_Frame &reconstructed, const MotionField &field,
+		const Motion_Statistics &statistics, Sequence_Result &result)
+{
+	result.frame = index;
+	result.blocks = statistics.blocks;
+	result.skipped_blocks = statistics.skipped_blocks;
+	result.scene_change = statistics.scene_change;
+	result.carried_blocks = statistics.carried_blocks;
+	result.global_x = statistics.global_x;
+	result.global_y = statistics.global_y;
+	result.PSNR = PSNR(frame, reconstructed);
+	result.cost = 0;
+	result.older_reference_blocks = 0;
+	for (int block = 0; block<field.get_blocks_x()*field.get_blocks_y(); block++)
+	{
+		result.cost = result.cost + field.cost_plane()[block];
+		if(field.has_references() && (field.reference(block%field.get_blocks_x(), block/field.get_blocks_x()) > 0))
+		{
+			result.older_reference_blocks++;
+		}
+	}
+}
+
+//Function used to check whether the search of a pair uses the motion field of the pair before it: its vectors are the
+//temporal predictors, and set the adaptive ranges
+//Inputs: parameters of the algorithm
+//Output: True if the pairs depend on each other, False if not
+static bool Uses_Previous_Field(const Motion_Parameters &parameters)
+{
+	return parameters.predictors || (parameters.adaptive_minimum > 0);
+}
+
+//Function used to load, search, reconstruct and write a frame pair, the macroblock rows being split between the threads
+//of a work stealing scheduler
+//Inputs: path of the frames, index of the frame to be predicted, estimator, macroblock rows per chunk, scheduler,
+//        result to be set
+//Output: True if the pair was processed, False if not
+static bool Process_Pair(const std::string &path, int index, MotionEstimator &estimator, int rows_per_task, Work_Stealing_Scheduler &scheduler,
+		Sequence_Result &result)
+{
+	TRACE_SCOPE_ARG("Frame Pair", index);
+	const Motion_Parameters &parameters = estimator.get_parameters();
+	jbutil::image<int> images[2];
+	for (int frame = 0; frame<2; frame++)
+	{
+		std::ifstream file(Frame_Path(path, "frame", index-1+frame).c_str());
+		if(!file)
+		{
+			#ifndef NDEBUG
+				std::cerr << "Error Loading Frame " << index-1+frame << "\n" << std::flush;
+			#endif
+			return false;
+		}
+		images[frame].load(file);
+	}
+
+	if(!estimator.check(images[1]) || (images[0].get_rows() != images[1].get_rows())
+			|| (images[0].get_cols() != images[1].get_cols()) || (images[0].channels() != images[1].channels()))
+	{
+		return false;
+	}
+	estimator.set_scheduler(&scheduler, rows_per_task);
+
+	Linear_Frame reference, current, reconstructed;
+	Linearize_Image(images[0], reference);
+	Linearize_Image(images[1], current);
+	MotionField field;
+	estimator.estimate(reference, current, field);
+
+	reconstructed.resize(current.rows, current.cols, current.channels);
+	const Linear_Frame* references[1] = {&reference};
+	Compensate_Frame(references, field, parameters.block_width, parameters.block_height, parameters.overlapped, &scheduler,
+			rows_per_task, reconstructed, &images[1]);
+	Set_Result(index, current, reconstructed, field, estimator.get_statistics(), result);
+	std::ofstream file(Frame_Path(path, "Reconstructed_Frame", index).c_str());
+	images[1].save(file);
+	return true;
+}
+
+//Function used to process the frame pairs as tasks of a work stealing scheduler
+//Inputs: path of the frames, parameters of the algorithm and of the scheduler, results to be set
+//Output: True if all the frames were processed, False if not
+static bool Process_Batch(const std::string &path, const Motion_Parameters &parameters, const Sequence_Parameters &sequence,
+		std::vector<Sequence_Result> &results)
+{
+	Work_Stealing_Scheduler scheduler(sequence.threads);
+
+	//when a pair uses the field of the pair before it, the pairs are processed in order by a single estimator, which
+	//keeps that field, and only the macroblock rows of every pair are split between the threads
+	if(Uses_Previous_Field(parameters))
+	{
+		MotionEstimator estimator(parameters);
+		for (int index = 2; index<=sequence.frames; index++)
+		{
+			if(!Process_Pair(path, index, estimator, sequence.rows_per_task, scheduler, results[index-2]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	std::atomic<bool> failed(false);
+	Task_Group pairs;
+	for (int index = 2; index<=sequence.frames; index++)
+	{
+		scheduler.Submit(pairs, [&, index]()
+		{
+			MotionEstimator estimator(parameters);
+			if(!Process_Pair(path, index, estimator, sequence.rows_per_task, scheduler, results[index-2]))
+			{
+				failed = true;
+			}
+		});
+	}
+	scheduler.Wait(pairs);
+	return !failed;
+}
+
+//Function used to process the frames in order with a multi-reference search, which keeps the reference frames of every
+//frame in its ring buffer
+//Inputs: path of the frames, parameters of the algorithm and of the scheduler, results to be set
+//Output: True if all the frames were processed, False if not
+static bool Process_References(const std::string &path, const Motion_Parameters &parameters, const Sequence_Parameters &sequence,
+		std::vector<Sequence_Result> &results)
+{
+	MotionEstimator estimator(parameters);
+	std::unique_ptr<Work_Stealing_Scheduler> scheduler;
+	if(sequence.threads != 0)
+	{
+		scheduler.reset(new Work_Stealing_Scheduler(sequence.threads));
+		estimator.set_scheduler(scheduler.get(), sequence.rows_per_task);
+	}
+
+	jbutil::image<int> image;
+	Linear_Frame frame, reconstructed;
+	MotionField field;
+	for (int index = 1; index<=sequence.frames; index++)
+	{
+		{
+			TRACE_SCOPE_ARG("Load Frame", index);
+			std::ifstream file(Frame_Path(path, "frame", index).c_str());
+			if(!file)
+			{
+				#ifndef NDEBUG
+					std::cerr << "Error Loading Frame " << index << "\n" << std::flush;
+				#endif
+				return false;
+			}
+			image.load(file);
+		}
+		if(!estimator.check(image) || ((index > 1) && ((image.get_rows() != frame.rows) || (image.get_cols() != frame.cols)
+				|| (image.channels() != frame.channels))))
+		{
+			return false;
+		}
+
+		Linearize_Image(image, frame);
+		{
+			TRACE_SCOPE_ARG("Search Frame", index);
+			if(!estimator.estimate_next(frame, field))
+			{
+				//the first frame is only a reference frame
+				continue;
+			}
+		}
+
+		reconstructed.resize(frame.rows, frame.cols, frame.channels);
+		estimator.reconstruct_next(field, reconstructed);
+		Set_Result(index, frame, reconstructed, field, estimator.get_statistics(), results[index-2]);
+
+		TRACE_SCOPE_ARG("Write Frame", index);
+		Delinearize_Image(reconstructed, image);
+		std::ofstream file(Frame_Path(path, "Reconstructed_Frame", index).c_str());
+		image.save(file);
+	}
+	return true;
+}
+
+bool Process_Sequence(const std::string &path, const Motion_Parameters &parameters, const Sequence_Parameters &sequence,
+		std::vector<Sequence_Result> &results)
+{
+	const int frames = sequence.frames;
+	results.assign(frames > 1 ? frames-1 : 0, Sequence_Result());
+
+	//the frames of a multi-reference search depend on all the frames before them, so they are not split into pairs
+	if(parameters.reference_frames > 1)
+	{
+		return Process_References(path, parameters, sequence, results);
+	}
+	if(sequence.schedule == SCHEDULE_WORK_STEALING)
+	{
+		return Process_Batch(path, parameters, sequence, results);
+	}
+
+	std::atomic<bool> failed(false);
+	std::atomic<int> in_flight(0);
+
+	//every frame is published here by the preprocess stage, for the search of the frame after it.
+	//The frame is published before being passed on, and at most depth frames are in the pipeline, which is not
+	//more than a queue can hold: no push has to wait, so the frame a search is waiting for is always published.
+	std::vector<std::promise<Frame_Pointer> > published(frames+1);
+	std::vector<std::future<Frame_Pointer> > references(frames+1);
+	for (int index = 1; index<=frames; index++)
+	{
+		references[index] = published[index].get_future();
+	}
+
+	//when a pair uses the field of the pair before it, every field is published here by the search stage for the search
+	//of the next frame, such that the vectors are the same whichever search worker searched the pair before (the
+	//searches then follow each other, while the other stages still overlap them). A failed frame, a scene change and the
+	//first frame publish an empty field. The search waiting for the field of the frame before it, the frames are then
+	//given to the search stage in order, or a search could wait for a frame still behind it in the search queue.
+	const bool previous_fields = Uses_Previous_Field(parameters);
+	std::vector<std::promise<Field_Pointer> > published_fields(previous_fields ? frames+1 : 0);
+	std::vector<std::future<Field_Pointer> > fields(previous_fields ? frames+1 : 0);
+	for (int index = 1; index<int(fields.size()); index++)
+	{
+		fields[index] = published_fields[index].get_future();
+	}
+	const Field_Pointer no_field(new MotionField);
+
+	//frames which are preprocessed before the frame before them are held here until they are next in order
+	std::mutex reorder_mutex;
+	std::map<int, Job_Pointer> reorder_buffer;
+	int next_search = 1;
+
+	//only check() is used, which does not modify the object and can be called from any thread
+	const MotionEstimator checker(parameters);
+	//one estimator per search worker, for their buffers
+	std::vector<std::unique_ptr<MotionEstimator> > estimators;
+	for (int worker = 0; worker<sequence.workers[STAGE_SEARCH]; worker++)
+	{
+		estimators.push_back(std::unique_ptr<MotionEstimator>(new MotionEstimator(parameters)));
+	}
+
+	Bounded_Queue<int> load_queue(sequence.depth);
+	Bounded_Queue<Job_Pointer> preprocess_queue(sequence.depth);
+	Bounded_Queue<Job_Pointer> search_queue(sequence.depth);
+	Bounded_Queue<Job_Pointer> reconstruct_queue(sequence.depth);
+	Bounded_Queue<Job_Pointer> write_queue(sequence.depth);
+	std::vector<std::thread> threads;
+
+	Start_Stage<int, Job_Pointer>("Load", sequence.workers[STAGE_LOAD], load_queue, &preprocess_queue,
+			[&](int, int &index, Bounded_Queue<Job_Pointer>* output)
+	{
+		TRACE_SCOPE_ARG("Load Frame", index);
+		Job_Pointer job(new Sequence_Job(index, &in_flight));
+		std::ifstream file(Frame_Path(path, "frame", index).c_str());
+		if(file)
+		{
+			job->image.load(file);
+		}
+		else
+		{
+			#ifndef NDEBUG
+				std::cerr << "Error Loading Frame " << index << "\n" << std::flush;
+			#endif
+			job->failed = true;
+		}
+		output->Push(job);
+	}, threads);
+
+	Start_Stage<Job_Pointer, Job_Pointer>("Preprocess", sequence.workers[STAGE_PREPROCESS], preprocess_queue, &search_queue,
+			[&](int, Job_Pointer &job, Bounded_Queue<Job_Pointer>* output)
+	{
+		TRACE_SCOPE_ARG("Preprocess Frame", job->index);
+		if(!job->failed && checker.check(job->image))
+		{
+			std::shared_ptr<Linear_Frame> frame(new Linear_Frame);
+			Linearize_Image(job->image, *frame);
+			job->frame = frame;
+		}
+		else
+		{
+			job->failed = true;
+		}
+		//a failed frame is published as NULL, such that the search of the next frame does not wait for it
+		published[job->index].set_value(job->frame);
+		if(!previous_fields)
+		{
+			output->Push(job);
+			return;
+		}
+		std::lock_guard<std::mutex> lock(reorder_mutex);
+		reorder_buffer[job->index] = job;
+		for (auto next = reorder_buffer.find(next_search); next != reorder_buffer.end(); next = reorder_buffer.find(++next_search))
+		{
+			output->Push(next->second);
+			reorder_buffer.erase(next);
+		}
+	}, threads);
+
+	Start_Stage<Job_Pointer, Job_Pointer>("Search", sequence.workers[STAGE_SEARCH], search_queue, &reconstruct_queue,
+			[&](int worker, Job_Pointer &job, Bounded_Queue<Job_Pointer>* output)
+	{
+		//the first frame is only a reference frame
+		if(job->index == 1)
+		{
+			if(previous_fields)
+			{
+				published_fields[1].set_value(no_field);
+			}
+			if(job->failed)
+			{
+				failed = true;
+			}
+			return;
+		}
+
+		//taking the frame out of its future also releases it once this job is done with it
+		Frame_Pointer reference = references[job->index-1].get();
+		Field_Pointer previous_field = previous_fields ? fields[job->index-1].get() : no_field;
+		if(job->failed || !reference || (reference->rows != job->frame->rows) || (reference->cols != job->frame->cols)
+				|| (reference->channels != job->frame->channels))
+		{
+			if(previous_fields)
+			{
+				published_fields[job->index].set_value(no_field);
+			}
+			failed = true;
+			return;
+		}
+
+		TRACE_SCOPE_ARG("Search Frame", job->index);
+		estimators[worker]->estimate(*reference, *job->frame, job->field, previous_fields ? previous_field.get() : NULL);
+		job->statistics = estimators[worker]->get_statistics();
+		job->reference = reference;
+		if(previous_fields)
+		{
+			//the zero vectors of a scene change say nothing about the motion of the next pair
+			published_fields[job->index].set_value(job->statistics.scene_change ? no_field : Field_Pointer(new MotionField(job->field)));
+		}
+		output->Push(job);
+	}, threads);
+
+	Start_Stage<Job_Pointer, Job_Pointer>("Reconstruct", sequence.workers[STAGE_RECONSTRUCT], reconstruct_queue, &write_queue,
+			[&](int, Job_Pointer &job, Bounded_Queue<Job_Pointer>* output)
+	{
+		TRACE_SCOPE_ARG("Reconstruct Frame", job->index);
+		Linear_Frame reconstructed;
+		reconstructed.resize(job->frame->rows, job->frame->cols, job->frame->channels);
+		const Linear_Frame* references[1] = {job->reference.get()};
+		Compensate_Frame(references, job->field, parameters.block_width, parameters.block_height, parameters.overlapped, NULL, 0,
+				reconstructed, &job->image);
+
+		Set_Result(job->index, *job->frame, reconstructed, job->field, job->statistics, results[job->index-2]);
+		job->frame.reset();
+		job->reference.reset();
+		output->Push(job);
+	}, threads);
+
+	Start_Stage<Job_Pointer, Job_Pointer>("Write", sequence.workers[STAGE_WRITE], write_queue, NULL,
+			[&](int, Job_Pointer &job, Bounded_Queue<Job_Pointer>*)
+	{
+		TRACE_SCOPE_ARG("Write Frame", job->index);
+		std::ofstream file(Frame_Path(path, "Reconstructed_Frame", job->index).c_str());
+		job->image.save(file);
+	}, threads);
+
+	//give the frames to the load stage in order, keeping at most depth frames in the pipeline
+	for (int index = 1; index<=frames; index++)
+	{
+		while(in_flight.load() >= sequence.depth)
+		{
+			std::this_thread::yield();
+		}
+		in_flight.fetch_add(1);
+		load_queue.Push(index);
+	}
+	load_queue.Close();
+
+	for (size_t thread = 0; thread<threads.size(); thread++)
+	{
+		threads[thread].join();
+	}
+	return !failed;
+}
@@ -0,0 +1,80 @@
+#ifndef __Sequence_h
+#define __Sequence_h
+
+#include "MotionEstimator.h"
+#include <string>
+#include <vector>
+
+//The stages of the sequence pipeline, in order
+enum Sequence_Stage
+{
+	STAGE_LOAD,				//reads frameK.ppm
+	STAGE_PREPROCESS,		//linearizes the frame, which is then shared as the current and the next reference frame
+	STAGE_SEARCH,			//block matching of frame K against frame K-1
+	STAGE_RECONSTRUCT,		//reconstruction of frame K and its PSNR
+	STAGE_WRITE,			//writes Reconstructed_FrameK.ppm
+	STAGE_COUNT
+};
+
+//The ways of scheduling the frames of a sequence
+enum Sequence_Schedule
+{
+	SCHEDULE_PIPELINE,			//stages with their own threads, connected by queues
+	SCHEDULE_WORK_STEALING		//every frame pair is a task of a work stealing scheduler, and so is every chunk of its macroblock rows
+};
+
+//struct to hold the parameters of the sequence pipeline and of the work stealing scheduler
+struct Sequence_Parameters
+{
+	int frames;						//number of frames, read from frame1.ppm to frameN.ppm
+	Sequence_Schedule schedule;
+	int workers[STAGE_COUNT];		//pipeline: number of threads for every stage
+	int depth;						//pipeline: maximum number of frames in the pipeline at once (also the size of the queues)
+	int threads;					//work stealing: number of threads (0 for one per core)
+	int rows_per_task;				//work stealing: number of macroblock rows in a chunk
+
+	Sequence_Parameters() : frames(2), schedule(SCHEDULE_PIPELINE), depth(8), threads(0), rows_per_task(4)
+	{
+		for (int stage = 0; stage<STAGE_COUNT; stage++)
+		{
+			workers[stage] = 1;
+		}
+	}
+};
+
+//struct to hold the result for every predicted frame (frame 2 to frame N)
+struct Sequence_Result
+{
+	int frame;
+	double PSNR;			//PSNR of the reconstructed frame against the frame, in dB
+	uint64_t cost;			//sum of the costs of all the macroblocks
+	int blocks;				//number of macroblocks
+	int skipped_blocks;		//number of macroblocks given a zero motion vector by the zero motion skip
+	bool scene_change;		//true if the frame was found to be a scene change (and was not searched)
+	int carried_blocks;		//number of macroblocks which kept their vector from the previous pair (incremental mode)
+	int global_x;			//global motion vector, from which the searches could start
+	int global_y;
+	int older_reference_blocks;	//number of macroblocks taken from a reference older than the previous frame (multi-reference search)
+};
+
+//Function used to compute the PSNR of a reconstructed frame, for 8-bit samples
+//Inputs: linearized frame and reconstructed frame
+//Output: PSNR in dB
+double PSNR(const Linear_Frame &frame, const Linear_Frame &reconstructed);
+
+//Function used to perform block matching on a sequence of frames, each frame being predicted from the one before it.
+//With the pipeline, the frames go through stages connected by bounded lock-free queues, such that the loading
+//of a frame, the search of the next one and the writing of an earlier one are done at the same time.
+//With work stealing, every frame pair is processed by a single task (which loads both of its frames), such that
+//the pairs are independent and the threads only wait for each other at the end of the batch.
+//With more than one reference frame, every frame is searched in the frames before it in turn, by a single estimator
+//which keeps them (the macroblock rows are split between the threads of a work stealing scheduler, if any).
+//With the predictors or the adaptive ranges, the search of a pair uses the motion field of the pair before it, which is
+//passed from search to search in the pipeline, and with work stealing the pairs are then processed in order, only their
+//macroblock rows being split between the threads: the vectors are the same whatever the number of threads.
+//Inputs: path of the frames, parameters of the algorithm and of the pipeline, results to be set (in frame order)
+//Output: True if all the frames were processed, False if not
+bool Process_Sequence(const std::string &path, const Motion_Parameters &parameters, const Sequence_Parameters &sequence,
+		std::vector<Sequence_Result> &results);
+
+#endif
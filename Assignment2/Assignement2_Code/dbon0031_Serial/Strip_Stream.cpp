@@ -0,0 +1,212 @@
+#include "Strip_Stream.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+bool Frame_Reader::open(const std::string &file_path)
+{
+	file.open(file_path.c_str(), std::ios::in | std::ios::binary);
+	if(!file)
+	{
+		#ifndef NDEBUG
+			std::cerr << "Error Loading " << file_path << "\n" << std::flush;
+		#endif
+		return false;
+	}
+
+	//the header is read as by jbutil::image::load: the descriptor, then the size after any comment or empty line, then
+	//the largest sample value
+	std::string line;
+	std::getline(file, line);
+	if((line.size() < 2) || (line[0] != 'P') || ((line[1] != '5') && (line[1] != '6')))
+	{
+		#ifndef NDEBUG
+			std::cerr << "Error: Only binary PPM and PGM files can be streamed \n" << std::flush;
+		#endif
+		return false;
+	}
+	channels = (line[1] == '6') ? 3 : 1;
+	do
+	{
+		std::getline(file, line);
+	} while(file && ((line.size() == 0) || (line[0] == '#')));
+	std::istringstream(line) >> cols >> rows;
+	std::getline(file, line);
+	std::istringstream(line) >> maxval;
+
+	if(!file || (rows <= 0) || (cols <= 0) || (maxval <= 0) || (maxval > 255))
+	{
+		#ifndef NDEBUG
+			std::cerr << "Error: " << file_path << " does not have 8-bit samples \n" << std::flush;
+		#endif
+		return false;
+	}
+	buffer.resize(cols*channels);
+	next_row = 0;
+	return true;
+}
+
+bool Frame_Reader::read_rows(Linear_Frame &frame, int row_start, int row_stop)
+{
+	assert(row_start == next_row && row_stop <= rows);
+	const int row_length = cols*channels;
+	for (int row = row_start; row<row_stop; row++)
+	{
+		if(!file.read(reinterpret_cast<char*>(&buffer[0]), row_length))
+		{
+			return false;
+		}
+		int* output = frame.pixel(row, 0);
+		for (int i = 0; i<row_length; i++)
+		{
+			output[i] = buffer[i];
+		}
+	}
+	next_row = std::max(next_row, row_stop);
+	return true;
+}
+
+bool Frame_Writer::open(const std::string &file_path, int rows, int cols, int channels)
+{
+	file.open(file_path.c_str(), std::ios::out | std::ios::binary);
+	if(!file)
+	{
+		return false;
+	}
+	file << ((channels == 3) ? "P6" : "P5") << std::endl;
+	file << "# file written by jbutil" << std::endl;
+	file << cols << " " << rows << std::endl;
+	file << 255 << std::endl;
+	buffer.resize(cols*channels);
+	return bool(file);
+}
+
+bool Frame_Writer::write_rows(const Linear_Frame &frame, int row_start, int row_stop)
+{
+	const int row_length = frame.cols*frame.channels;
+	for (int row = row_start; row<row_stop; row++)
+	{
+		const int* input = frame.pixel(row, 0);
+		for (int i = 0; i<row_length; i++)
+		{
+			assert(input[i] >= 0 && input[i] <= 255);
+			buffer[i] = (unsigned char)input[i];
+		}
+		file.write(reinterpret_cast<const char*>(&buffer[0]), row_length);
+	}
+	return bool(file);
+}
+
+bool Process_Strips(const std::string &path, const Motion_Parameters &parameters, Strip_Result &result)
+{
+	if((parameters.scene_change_threshold > 0) || (parameters.global_range > 0) || parameters.incremental || parameters.overlapped
+			|| (parameters.reference_frames > 1))
+	{
+		#ifndef NDEBUG
+			std::cerr << "Error: Scene change detection, global motion, the incremental mode, OBMC and multiple references cannot be streamed \n" << std::flush;
+		#endif
+		return false;
+	}
+
+	Frame_Reader reference_reader, current_reader;
+	if(!reference_reader.open(path+std::string("/frame1.ppm")) || !current_reader.open(path+std::string("/frame2.ppm")))
+	{
+		return false;
+	}
+	const int rows = current_reader.get_rows();
+	const int cols = current_reader.get_cols();
+	const int channels = current_reader.get_channels();
+	if((reference_reader.get_rows() != rows) || (reference_reader.get_cols() != cols) || (reference_reader.get_channels() != channels))
+	{
+		#ifndef NDEBUG
+			std::cerr << "Error: The frames do not have the same size \n" << std::flush;
+		#endif
+		return false;
+	}
+
+	MotionEstimator estimator(parameters);
+	if(!estimator.check(rows, cols, std::max(reference_reader.range(), current_reader.range())))
+	{
+		return false;
+	}
+	Frame_Writer writer;
+	if(!writer.open(path+std::string("/Reconstructed_Frame.ppm"), rows, cols, channels))
+	{
+		return false;
+	}
+
+	//the window of the reference frame holds the rows which the searches of a macroblock row can read; the current and
+	//the reconstructed frames hold a macroblock row
+	const int block_width = parameters.block_width;
+	const int block_height = parameters.block_height;
+	const int blocks_y = rows/block_height;
+	int margin_above, margin_below;
+	estimator.get_strip_margins(margin_above, margin_below);
+	Linear_Frame reference, current, reconstructed;
+	reference.resize_window(rows, cols, channels, std::min(margin_above+block_height+margin_below, rows));
+	current.resize_window(rows, cols, channels, block_height);
+	reconstructed.resize_window(rows, cols, channels, block_height);
+	const Linear_Frame* references[1] = {&reference};
+
+	MotionField field;
+	uint64_t SSE = 0;
+	int reference_stop = 0;		//the reference rows held are from reference.row_offset to reference_stop (exclusive)
+	for (int y = 0; y<blocks_y; y++)
+	{
+		const int window_start = std::max(y*block_height-margin_above, 0);
+		const int window_stop = std::min((y+1)*block_height+margin_below, rows);
+		{
+			TRACE_SCOPE_ARG("Load Rows", y);
+			//the rows above the window are dropped, and the rows kept are moved to the start of the buffer
+			if(window_start > reference.row_offset)
+			{
+				std::memmove(&reference.data[0], reference.pixel(window_start, 0), (reference_stop-window_start)*reference.stride()*sizeof(int));
+				reference.row_offset = window_start;
+			}
+			current.row_offset = y*block_height;
+			if(!reference_reader.read_rows(reference, reference_stop, window_stop) || !current_reader.read_rows(current, y*block_height, (y+1)*block_height))
+			{
+				#ifndef NDEBUG
+					std::cerr << "Error Loading Rows \n" << std::flush;
+				#endif
+				return false;
+			}
+			reference_stop = window_stop;
+		}
+
+		{
+			TRACE_SCOPE_ARG("Search Rows", y);
+			estimator.estimate_rows(reference, current, y, y+1, field);
+		}
+
+		{
+			TRACE_SCOPE_ARG("Write Rows", y);
+			reconstructed.row_offset = y*block_height;
+			Compensate_Macroblock_Rows(references, field, block_width, block_height, false, y, y+1, reconstructed);
+			for (int i = 0; i<reconstructed.data.size(); i++)
+			{
+				int difference = current.data[i] - reconstructed.data[i];
+				SSE = SSE + uint64_t(difference*difference);
+			}
+			if(!writer.write_rows(reconstructed, y*block_height, (y+1)*block_height))
+			{
+				return false;
+			}
+		}
+	}
+
+	const uint64_t samples = uint64_t(rows)*uint64_t(cols)*uint64_t(channels);
+	result.PSNR = (SSE == 0) ? INFINITY : 10.0*std::log10(255.0*255.0/(double(SSE)/double(samples)));
+	result.blocks = estimator.get_statistics().blocks;
+	result.skipped_blocks = estimator.get_statistics().skipped_blocks;
+	result.cost = 0;
+	for (int block = 0; block<field.get_blocks_x()*field.get_blocks_y(); block++)
+	{
+		result.cost = result.cost + field.cost_plane()[block];
+	}
+	result.resident_bytes = (reference.data.size() + current.data.size() + reconstructed.data.size())*sizeof(int);
+	result.frame_bytes = samples*sizeof(int);
+	return true;
+}
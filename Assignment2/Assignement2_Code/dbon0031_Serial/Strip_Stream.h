@@ -0,0 +1,97 @@
+#ifndef __Strip_Stream_h
+#define __Strip_Stream_h
+
+#include "MotionEstimator.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+//Strip streaming: a frame pair is predicted a macroblock row at a time while the frames are read, such that neither
+//frame is ever held whole. Only the rows of the reference frame which the searches of the current macroblock row can
+//read are kept (the macroblock rows and the search margins above and below them), with the macroblock rows of the
+//current and of the reconstructed frames, and every reconstructed macroblock row is written out as soon as it is set.
+//The frame data held at once is then about width*(block_height + 2*range) pixels, whatever the height of the frames.
+
+//Class used to read the rows of a binary PPM (P6) or PGM (P5) file with samples of up to 8 bits, one after the other
+class Frame_Reader
+{
+public:
+	Frame_Reader() : rows(0), cols(0), channels(0), maxval(0), next_row(0)
+	{
+	}
+
+	//Function used to open a file and read its header
+	//Inputs: path of the file
+	//Output: True if the file is a binary PPM or PGM with samples of up to 8 bits, False if not
+	bool open(const std::string &file_path);
+
+	//Function used to read the next rows of the file into a linearized frame
+	//Inputs: frame whose rows from row_start to row_stop (exclusive) are set (they must be in its window), first row,
+	//        which must be the next row of the file, and last (exclusive) row
+	//Output: True if the rows were read, False if not
+	bool read_rows(Linear_Frame &frame, int row_start, int row_stop);
+
+	int get_rows() const
+	{
+		return rows;
+	}
+	int get_cols() const
+	{
+		return cols;
+	}
+	int get_channels() const
+	{
+		return channels;
+	}
+	int range() const
+	{
+		return maxval;
+	}
+
+private:
+	std::ifstream file;
+	int rows, cols, channels, maxval;
+	int next_row;
+	std::vector<unsigned char> buffer;		//the samples of a row as stored in the file
+};
+
+//Class used to write a binary PPM (P6) or PGM (P5) file with 8-bit samples a range of rows at a time, with the same
+//header as jbutil::image::save
+class Frame_Writer
+{
+public:
+	//Function used to create a file and write its header
+	//Inputs: path of the file, size of the frame
+	//Output: True if the file was created, False if not
+	bool open(const std::string &file_path, int rows, int cols, int channels);
+
+	//Function used to write the next rows of the file from a linearized frame
+	//Inputs: frame, first and last (exclusive) row to be written (they must be in its window)
+	//Output: True if the rows were written, False if not
+	bool write_rows(const Linear_Frame &frame, int row_start, int row_stop);
+
+private:
+	std::ofstream file;
+	std::vector<unsigned char> buffer;
+};
+
+//struct to hold the result of a strip streamed frame pair
+struct Strip_Result
+{
+	double PSNR;				//PSNR of the reconstructed frame against the frame, in dB
+	uint64_t cost;				//sum of the costs of all the macroblocks
+	int blocks;					//number of macroblocks
+	int skipped_blocks;			//number of macroblocks given a zero motion vector by the zero motion skip
+	size_t resident_bytes;		//bytes of frame data held at once: the rows of the reference, current and reconstructed frames
+	size_t frame_bytes;			//bytes of a whole linearized frame, for comparison
+};
+
+//Function used to predict frame2.ppm from frame1.ppm of a directory with strip streaming, writing the reconstructed
+//frame to Reconstructed_Frame.ppm as its macroblock rows are set. The motion vectors are the same as those of a search
+//of the whole frames. Scene change detection, global motion, the incremental mode, OBMC and multi-reference search
+//need whole frames and cannot be used.
+//Inputs: path of the frames, parameters of the algorithm, result to be set
+//Output: True if the pair was processed, False if not
+bool Process_Strips(const std::string &path, const Motion_Parameters &parameters, Strip_Result &result);
+
+#endif
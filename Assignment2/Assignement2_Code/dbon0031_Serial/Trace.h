@@ -0,0 +1,204 @@
+#ifndef __Trace_h
+#define __Trace_h
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <stdint.h>
+
+//Tracing facility used to time the stages of the program on a monotonic clock.
+//Every thread records its own events, which are written out together in the Chrome
+//trace JSON format (viewable in chrome://tracing or https://ui.perfetto.dev).
+//Recording is off until Trace_Recorder::Instance().Enable() is called, so the
+//scopes left in the code cost a single branch in a normal run. The scopes are placed around
+//frames and chunks of macroblock rows, never around a single macroblock, such that the
+//events time the work rather than the clock reads and the recording.
+
+//struct to hold a single timed event
+struct Trace_Event
+{
+	const char* name;		//name of the stage (must be a string literal)
+	int64_t start;			//start time in ns, relative to the creation of the recorder
+	int64_t duration;		//duration in ns
+	int arg;				//optional argument shown with the event (eg: the search step), -1 if unused
+};
+
+//struct to hold the events recorded by a single thread
+struct Trace_Thread
+{
+	int id;
+	std::string name;
+	std::vector<Trace_Event> events;
+};
+
+class Trace_Recorder
+{
+public:
+	//Function used to get the single recorder used by the program
+	static Trace_Recorder& Instance()
+	{
+		static Trace_Recorder recorder;
+		return recorder;
+	}
+
+	//Function used to get the current time in ns on the monotonic clock
+	static int64_t Now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	//Function used to start recording, which registers the calling thread as the main thread (thread 0 of the trace):
+	//it must be called by the main thread, before any other thread is started
+	void Enable()
+	{
+		Name_Thread("Main");
+		enabled.store(true, std::memory_order_release);
+	}
+
+	//the flag is read by the worker threads as well
+	bool Enabled() const
+	{
+		return enabled.load(std::memory_order_acquire);
+	}
+
+	//Function used to store an event for the calling thread
+	//Inputs: name of the event, start time and stop time (as returned by Now()), optional argument
+	//Output: None
+	void Record(const char* name, int64_t start, int64_t stop, int arg = -1)
+	{
+		Trace_Event event = {name, start - origin, stop - start, arg};
+		This_Thread()->events.push_back(event);
+	}
+
+	//Function used to give the calling thread a name in the trace viewer
+	//Inputs: name of the thread
+	//Output: None
+	void Name_Thread(const std::string& name)
+	{
+		This_Thread()->name = name;
+	}
+
+	//Function used to write all the recorded events in the Chrome trace JSON format
+	//Inputs: path of the output file
+	//Output: True if the file was written, False if not
+	bool Save(const std::string& path)
+	{
+		std::ofstream file(path.c_str());
+		if(!file)
+		{
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		bool first = true;
+		for (size_t thread = 0; thread<threads.size(); thread++)
+		{
+			//metadata event used to label the thread's track
+			file << (first ? "\n" : ",\n");
+			first = false;
+			file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << threads[thread]->id
+				 << ",\"args\":{\"name\":\"" << threads[thread]->name << "\"}}";
+
+			const std::vector<Trace_Event>& events = threads[thread]->events;
+			for (size_t event = 0; event<events.size(); event++)
+			{
+				//timestamps are given in microseconds, keeping ns precision
+				file << ",\n{\"name\":\"" << events[event].name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << threads[thread]->id
+					 << ",\"ts\":" << events[event].start/1000 << "." << Three_Digits(events[event].start%1000)
+					 << ",\"dur\":" << events[event].duration/1000 << "." << Three_Digits(events[event].duration%1000);
+				if(events[event].arg >= 0)
+				{
+					file << ",\"args\":{\"value\":" << events[event].arg << "}";
+				}
+				file << "}";
+			}
+		}
+		file << "\n]}\n";
+		return bool(file);
+	}
+
+	~Trace_Recorder()
+	{
+		for (size_t thread = 0; thread<threads.size(); thread++)
+		{
+			delete threads[thread];
+		}
+	}
+
+private:
+	Trace_Recorder() : enabled(false), origin(Now())
+	{
+	}
+
+	//Function used to get the event list of the calling thread, registering it on first use.
+	//The lists are owned by the recorder, so events survive the threads that recorded them
+	Trace_Thread* This_Thread()
+	{
+		static thread_local Trace_Thread* this_thread = NULL;
+		if(this_thread == NULL)
+		{
+			std::lock_guard<std::mutex> lock(threads_mutex);
+			this_thread = new Trace_Thread;
+			this_thread->id = int(threads.size());
+			this_thread->name = std::string("Thread ") + std::to_string(this_thread->id);
+			threads.push_back(this_thread);
+		}
+		return this_thread;
+	}
+
+	static std::string Three_Digits(int64_t value)
+	{
+		std::string digits = std::to_string(value);
+		return std::string(3-digits.size(), '0') + digits;
+	}
+
+	std::atomic<bool> enabled;
+	int64_t origin;
+	std::mutex threads_mutex;
+	std::vector<Trace_Thread*> threads;
+};
+
+//Class used to time a scope: the event is recorded when the object goes out of scope
+class Trace_Scope
+{
+public:
+	explicit Trace_Scope(const char* name, int arg = -1) : name(name), arg(arg), start(0)
+	{
+		if(Trace_Recorder::Instance().Enabled())
+		{
+			start = Trace_Recorder::Now();
+		}
+	}
+
+	~Trace_Scope()
+	{
+		if(start != 0)
+		{
+			Trace_Recorder::Instance().Record(name, start, Trace_Recorder::Now(), arg);
+		}
+	}
+
+private:
+	const char* name;
+	int arg;
+	int64_t start;
+};
+
+//Function used to get the current time in seconds on the monotonic clock (replaces jbutil::gettime for timings)
+inline double Trace_Seconds()
+{
+	return double(Trace_Recorder::Now())*1E-9;
+}
+
+#define TRACE_CONCATENATE_(a, b) a##b
+#define TRACE_CONCATENATE(a, b) TRACE_CONCATENATE_(a, b)
+
+//Macros used to time the enclosing scope, optionally with an integer argument
+#define TRACE_SCOPE(name) Trace_Scope TRACE_CONCATENATE(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, arg) Trace_Scope TRACE_CONCATENATE(trace_scope_, __LINE__)(name, arg)
+
+#endif
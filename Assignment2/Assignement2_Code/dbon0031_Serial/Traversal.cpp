@@ -0,0 +1,139 @@
+#include "Traversal.h"
+
+//Function used to get the co-ordinates of the point at a given position along a Morton (Z-order) curve
+//Inputs: position along the curve, co-ordinates to be set
+//Output: None
+static void Z_Order_Point(int position, int &x, int &y)
+{
+	//the bits of x and y are interleaved in the position, x in the even bits
+	x = 0;
+	y = 0;
+	for (int bit = 0; (position >> (2*bit)) != 0; bit++)
+	{
+		x = x | (((position >> (2*bit)) & 1) << bit);
+		y = y | (((position >> (2*bit+1)) & 1) << bit);
+	}
+}
+
+//Function used to get the co-ordinates of the point at a given position along a Hilbert curve
+//Inputs: side of the square covered by the curve (a power of 2), position along the curve, co-ordinates to be set
+//Output: None
+static void Hilbert_Point(int side, int position, int &x, int &y)
+{
+	x = 0;
+	y = 0;
+	for (int size = 1; size<side; size = size*2)
+	{
+		int quadrant_x = 1 & (position/2);
+		int quadrant_y = 1 & (position ^ quadrant_x);
+
+		//rotate the sub-curve such that it joins the sub-curves of the quadrants before and after it
+		if(quadrant_y == 0)
+		{
+			if(quadrant_x == 1)
+			{
+				x = size-1-x;
+				y = size-1-y;
+			}
+			int temporary = x;
+			x = y;
+			y = temporary;
+		}
+
+		x = x + size*quadrant_x;
+		y = y + size*quadrant_y;
+		position = position/4;
+	}
+}
+
+void Get_Traversal(Traversal_Order order, int blocks_x, int row_start, int row_stop, int tile_size, std::vector<int> &blocks)
+{
+	blocks.clear();
+	const int rows = row_stop-row_start;
+
+	switch(order)
+	{
+		case TRAVERSAL_TILED:
+		{
+			tile_size = (tile_size > 0) ? tile_size : 1;
+			for (int tile_y = 0; tile_y<rows; tile_y = tile_y+tile_size)
+			{
+				for (int tile_x = 0; tile_x<blocks_x; tile_x = tile_x+tile_size)
+				{
+					for (int y = tile_y; (y<tile_y+tile_size) && (y<rows); y++)
+					{
+						for (int x = tile_x; (x<tile_x+tile_size) && (x<blocks_x); x++)
+						{
+							blocks.push_back(x+(row_start+y)*blocks_x);
+						}
+					}
+				}
+			}
+			break;
+		}
+
+		case TRAVERSAL_Z_ORDER:
+		case TRAVERSAL_HILBERT:
+		{
+			//the curves cover squares with a power of 2 side, as large as the shorter side of the range of rows:
+			//the range is covered by a line of such squares, and the points of a square which are outside the range are skipped
+			int side = 1;
+			while((side < blocks_x) && (side < rows))
+			{
+				side = side*2;
+			}
+			const bool along_x = (blocks_x >= rows);
+			const int squares = along_x ? (blocks_x+side-1)/side : (rows+side-1)/side;
+
+			for (int square = 0; square<squares; square++)
+			{
+				for (int position = 0; position<side*side; position++)
+				{
+					int x, y;
+					if(order == TRAVERSAL_Z_ORDER)
+					{
+						Z_Order_Point(position, x, y);
+					}
+					else
+					{
+						Hilbert_Point(side, position, x, y);
+					}
+					x = x + (along_x ? square*side : 0);
+					y = y + (along_x ? 0 : square*side);
+					if((x < blocks_x) && (y < rows))
+					{
+						blocks.push_back(x+(row_start+y)*blocks_x);
+					}
+				}
+			}
+			break;
+		}
+
+		case TRAVERSAL_RASTER:
+		default:
+			for (int y = row_start; y<row_stop; y++)
+			{
+				for (int x = 0; x<blocks_x; x++)
+				{
+					blocks.push_back(x+y*blocks_x);
+				}
+			}
+			break;
+	}
+}
+
+int Get_Tile_Size(int block_width, int block_height, int reach_x, int reach_y, int channels, int cache_size)
+{
+	int tile_size = 1;
+	for (;;)
+	{
+		//the search windows of a tile of (tile_size+1)^2 macroblocks, as integers
+		int next = tile_size+1;
+		long long window_bytes = (long long)(next*block_width + 2*reach_x)*(next*block_height + 2*reach_y)*channels*sizeof(int);
+		if((window_bytes > cache_size) || (next > 64))
+		{
+			return tile_size;
+		}
+		tile_size = next;
+	}
+}
@@ -0,0 +1,27 @@
+#ifndef __Traversal_h
+#define __Traversal_h
+
+#include <vector>
+
+//The orders in which the macroblocks of a frame can be searched
+enum Traversal_Order
+{
+	TRAVERSAL_RASTER,		//row by row
+	TRAVERSAL_TILED,		//square tiles of macroblocks in raster order, row by row within a tile
+	TRAVERSAL_Z_ORDER,		//Morton order: the quadrants of a square are visited recursively in the order top left, top right, bottom left, bottom right
+	TRAVERSAL_HILBERT		//Hilbert curve: as Z-order, but consecutive macroblocks are always neighbours
+};
+
+//Function used to get the order in which the macroblocks of a range of macroblock rows are searched
+//Inputs: traversal order, number of macroblocks in a row, first and last (exclusive) macroblock row,
+//        tile size in macroblocks (tiled order only), list to be set with the indices (x+y*blocks_x) of the macroblocks
+//Output: None
+void Get_Traversal(Traversal_Order order, int blocks_x, int row_start, int row_stop, int tile_size, std::vector<int> &blocks);
+
+//Function used to choose the tile size of the tiled order, such that the search windows of the macroblocks of a tile
+//(a tile grown by the search reach on every side) fit in a given cache size
+//Inputs: macroblock width and height, search reach along x and y, number of channels, cache size in bytes
+//Output: tile size in macroblocks (at least 1)
+int Get_Tile_Size(int block_width, int block_height, int reach_x, int reach_y, int channels, int cache_size);
+
+#endif